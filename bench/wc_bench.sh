@@ -0,0 +1,45 @@
+#!/bin/bash
+#wc_bench.sh
+#Drake Wheeler
+
+#times the psush wc builtin against the system wc on the same file and
+#checks that they agree. Run from the top of the repo after make:
+#    bench/wc_bench.sh [size in MiB] [runs]
+#A file of generated text is made in /tmp unless BENCH_FILE names one.
+
+SIZE_MB=${1:-512}
+RUNS=${2:-3}
+PSUSH=${PSUSH:-./psush}
+FILE=${BENCH_FILE:-/tmp/psush_wc_bench.txt}
+TIMEFORMAT=%R
+
+if [ ! -x "$PSUSH" ]; then
+	echo "no $PSUSH, run make first" >&2
+	exit 1
+fi
+
+if [ -z "$BENCH_FILE" ]; then
+	#mixed line lengths and runs of white space, so the word counting has
+	#something to do
+	yes 'the quick  brown fox	jumps over the lazy dog 0123456789
+short
+  leading and trailing space   ' | head -c $((SIZE_MB << 20)) > "$FILE"
+fi
+
+#the builtin counts words the way the C locale does, and in a multibyte
+#locale hands -w to the system wc, so both sides run with LC_ALL=C
+export LC_ALL=C
+for opts in "-l" "-w" "-c" ""; do
+	want=$(wc $opts < "$FILE")
+	got=$(printf 'wc %s < %s\nbye\n' "$opts" "$FILE" | "$PSUSH" 2>/dev/null)
+	[ "$want" == "$got" ] || echo "wc $opts: system says '$want', psush says '$got'"
+
+	for ((i = 0; i < RUNS; ++i)); do
+		sys=$( { time wc $opts < "$FILE" > /dev/null; } 2>&1 )
+		ours=$( { time printf 'wc %s < %s\nbye\n' "$opts" "$FILE" | "$PSUSH" > /dev/null 2>&1; } 2>&1 )
+		printf 'wc %-3s system %6ss  psush %6ss\n' "$opts" "$sys" "$ours"
+	done
+done
+
+[ -z "$BENCH_FILE" ] && rm -f "$FILE"
+exit 0
@@ -0,0 +1,437 @@
+//builtin.c
+//Drake Wheeler
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <dlfcn.h>
+
+#include "cmd_parse.h"
+#include "builtin.h"
+
+extern unsigned short is_verbose;
+extern int last_exit_status;
+extern volatile sig_atomic_t got_sigint;
+
+static builtin_t* table[BUILTIN_BUCKETS] = {NULL}; //command name to builtin
+
+
+static void cd_builtin(cmd_t* cmd)
+{
+	if (cmd->param_count == 0)
+	{
+		// Just a "cd" on the command line without a target directory
+		// need to cd to the HOME directory.
+
+		// Is there an environment variable, somewhere, that contains
+		// the HOME directory that could be used as an argument to
+		// the chdir() fucntion?
+		if(chdir(getenv("HOME")) != 0) //go to home directory
+		{
+			perror("cd failed");
+		}
+	}
+	else
+	{
+		// try and cd to the target directory. It would be good to check
+		// for errors here.
+		if (chdir(cmd->param_list->param) != 0)
+		{
+			// a sad chdir.  :-(
+			if(is_verbose) perror("cd failed");
+		}
+	}
+
+	return;
+}
+
+
+static void cwd_builtin(__attribute__ ((unused)) cmd_t* cmd)
+{
+	char str[MAXPATHLEN];
+
+	// Fetch the Current Working Wirectory (CWD).
+	// aka - get country western dancing
+	getcwd(str, MAXPATHLEN);
+	printf(" " CWD_CMD ": %s\n", str);
+
+	return;
+}
+
+
+static void echo_builtin(cmd_t* cmd)
+{
+	param_t* param = cmd->param_list; //set a pointer to the parameter list
+
+	while(param) //loop through the list
+	{
+		printf("%s ", param->param); //print each parameter with a space
+		param = param->next; //go to next parameter in the list
+	}
+	printf("\n"); //end with a newline
+
+	return;
+}
+
+
+static void bye_builtin(__attribute__ ((unused)) cmd_t* cmd)
+{
+	builtin_cleanup(); //gives loaded builtins their unload()
+	exit(EXIT_SUCCESS);
+}
+
+
+static void history_builtin(__attribute__ ((unused)) cmd_t* cmd)
+{
+	display_history();
+
+	return;
+}
+
+
+//the builtins compiled in. Loaded ones are added by enable -f.
+static builtin_t core[] = {
+	{CD_CMD,      cd_builtin,      NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{CWD_CMD,     cwd_builtin,     NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{ECHO_CMD,    echo_builtin,    NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{BYE_CMD,     bye_builtin,     NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{HISTORY_CMD, history_builtin, NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{PIN_CMD,     pin_builtin,     NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{PIPES_CMD,   pipes_builtin,   NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{ENABLE_CMD,  enable_builtin,  NULL,   NULL,           NULL,         NULL, NULL, NULL, NULL},
+	{WC_CMD,      NULL,            wc_run, NULL,           wc_supported, NULL, NULL, NULL, NULL},
+	{WATCH_CMD,   NULL,            NULL,   watch_builtin,  NULL,         NULL, NULL, NULL, NULL},
+	{CACHE_CMD,   NULL,            NULL,   cache_builtin,  NULL,         NULL, NULL, NULL, NULL},
+};
+
+
+//FNV-1a, folded onto the table
+static unsigned builtin_hash(const char* name)
+{
+	unsigned h = 2166136261u;
+
+	while (*name)
+	{
+		h ^= (unsigned char) *name++;
+		h *= 16777619u;
+	}
+
+	return h & (BUILTIN_BUCKETS - 1);
+}
+
+
+static builtin_t* builtin_find(const char* name)
+{
+	builtin_t* b = table[builtin_hash(name)];
+
+	while (b && strcmp(b->name, name) != 0)
+	{
+		b = b->next;
+	}
+
+	return b;
+}
+
+
+static void builtin_add(builtin_t* b)
+{
+	unsigned h = builtin_hash(b->name);
+
+	b->next = table[h];
+	table[h] = b;
+
+	return;
+}
+
+
+static void builtin_remove(builtin_t* b)
+{
+	builtin_t** link = &table[builtin_hash(b->name)];
+
+	while (*link && *link != b)
+	{
+		link = &(*link)->next;
+	}
+	if (*link) *link = b->next;
+
+	return;
+}
+
+
+void builtin_init(void)
+{
+	for (size_t i = 0; i < sizeof(core) / sizeof(core[0]); ++i)
+	{
+		builtin_add(&core[i]);
+	}
+
+	return;
+}
+
+
+//the builtin that will carry out cmd, or NULL if it's for execvp()
+builtin_t* builtin_for(cmd_t* cmd)
+{
+	builtin_t* b = NULL;
+
+	if (cmd == NULL || cmd->cmd == NULL) return NULL;
+	b = builtin_find(cmd->cmd);
+	if (b && b->takes && !b->takes(cmd)) return NULL; //arguments it can't do, use the real one
+
+	return b;
+}
+
+
+//true for builtins that only work as the shell itself, with no fds to
+//hand them and no output to catch
+int builtin_in_shell(builtin_t* b)
+{
+	return b->run != NULL || b->prefix != NULL;
+}
+
+
+//runs a stage or loaded builtin on the given fds, returning its exit status
+int builtin_stage(builtin_t* b, cmd_t* cmd, int in_fd, int out_fd)
+{
+	char** argv = NULL;
+	param_t* param = cmd->param_list;
+	int argc = 0;
+	int ret = 0;
+
+	if (b->plugin == NULL) return b->stage(cmd, in_fd, out_fd);
+
+	argv = calloc(cmd->param_count + 2, sizeof(char*));
+	argv[argc++] = cmd->cmd;
+	while (param)
+	{
+		argv[argc++] = param->param;
+		param = param->next;
+	}
+	argv[argc] = NULL;
+
+	optind = 0; //plugins that use getopt() start fresh every run
+	ret = b->plugin->run(argc, argv, in_fd, out_fd);
+	free(argv);
+
+	return ret;
+}
+
+
+//runs a builtin for a command on its own. Ones that work on fds get the <
+//and > redirection done here, since there's no child to dup2() in.
+void builtin_exec(builtin_t* b, cmd_t* cmd)
+{
+	int fd_in = STDIN_FILENO;
+	int fd_out = STDOUT_FILENO;
+	struct sigaction sa;
+	struct sigaction old_sa;
+
+	if (b->run)
+	{
+		b->run(cmd);
+		return;
+	}
+
+	if (cmd->input_src == REDIRECT_FILE || cmd->input_src == REDIRECT_HERE)
+	{
+		if (cmd->input_src == REDIRECT_FILE) fd_in = open(cmd->input_file_name, O_RDONLY);
+		else fd_in = here_open(cmd->here_body, cmd->here_len);
+		if (fd_in < 0)
+		{
+			fprintf(stderr, "***** input redirection failed %d *****\n", errno);
+			last_exit_status = 7;
+			return;
+		}
+	}
+	if (cmd->output_dest == REDIRECT_FILE)
+	{
+		fd_out = open(cmd->output_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd_out < 0)
+		{
+			fprintf(stderr, "***** output redirection failed %d *****\n", errno);
+			if (fd_in != STDIN_FILENO) close(fd_in);
+			last_exit_status = 7;
+			return;
+		}
+	}
+
+	fflush(stdout); //anything we printed goes out before what it writes
+
+	//signal() restarts a read() that Ctrl-C interrupts, which would leave a
+	//builtin reading a terminal or a big file with no way to stop it. While
+	//it runs, Ctrl-C fails the blocked call with EINTR and sets got_sigint.
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = sigint_handler;
+	sa.sa_flags = 0;
+	sigaction(SIGINT, &sa, &old_sa);
+	got_sigint = 0;
+
+	last_exit_status = builtin_stage(b, cmd, fd_in, fd_out);
+	if (got_sigint) last_exit_status = 128 + SIGINT;
+
+	sigaction(SIGINT, &old_sa, NULL);
+	got_sigint = 0;
+
+	if (fd_in != STDIN_FILENO) close(fd_in);
+	if (fd_out != STDOUT_FILENO) close(fd_out);
+
+	return;
+}
+
+
+static void builtin_unload(builtin_t* b)
+{
+	if (b->plugin->unload) b->plugin->unload();
+	dlclose(b->handle);
+	free((char*) b->name);
+	free(b->path);
+	free(b);
+
+	return;
+}
+
+
+static void enable_load(const char* path, const char* name)
+{
+	char sym[NAME_MAX] = {'\0'};
+	void* handle = NULL;
+	const psush_builtin_t* plugin = NULL;
+	builtin_t* b = NULL;
+
+	if (builtin_find(name))
+	{
+		fprintf(stderr, ENABLE_CMD ": %s: already a builtin\n", name);
+		return;
+	}
+
+	//RTLD_LOCAL keeps one plugin's symbols from answering for another's
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL)
+	{
+		fprintf(stderr, ENABLE_CMD ": %s\n", dlerror());
+		return;
+	}
+	snprintf(sym, sizeof(sym), "%s" BUILTIN_SYM_SUFFIX, name);
+	plugin = dlsym(handle, sym);
+	if (plugin == NULL)
+	{
+		fprintf(stderr, ENABLE_CMD ": %s: no %s in %s\n", name, sym, path);
+		dlclose(handle);
+		return;
+	}
+	if (plugin->abi != PSUSH_BUILTIN_ABI || plugin->run == NULL)
+	{
+		fprintf(stderr, ENABLE_CMD ": %s: built for plugin ABI %d, this shell has %d\n"
+				, name, plugin->abi, PSUSH_BUILTIN_ABI);
+		dlclose(handle);
+		return;
+	}
+	if (plugin->load && plugin->load() != 0)
+	{
+		fprintf(stderr, ENABLE_CMD ": %s: refused to load\n", name);
+		dlclose(handle);
+		return;
+	}
+
+	b = calloc(1, sizeof(builtin_t));
+	b->name = strdup(name);
+	b->plugin = plugin;
+	b->handle = handle;
+	b->path = strdup(path);
+	builtin_add(b);
+	if (is_verbose) fprintf(stderr, "verbose: " ENABLE_CMD ": %s loaded from %s\n", name, path);
+
+	return;
+}
+
+
+static void enable_list(void)
+{
+	for (int i = 0; i < BUILTIN_BUCKETS; ++i)
+	{
+		for (builtin_t* b = table[i]; b; b = b->next)
+		{
+			if (b->plugin)
+			{
+				printf(" %-10s loaded from %s", b->name, b->path);
+				if (b->plugin->usage) printf(", %s", b->plugin->usage);
+				printf("\n");
+			}
+			else
+			{
+				printf(" %-10s builtin%s\n", b->name
+						, b->stage ? ", pipeline stage" : b->prefix ? ", takes a pipeline" : "");
+			}
+		}
+	}
+
+	return;
+}
+
+
+//enable                     lists the builtins
+//enable -f lib.so name ...  loads each name from lib.so
+//enable -d name ...         unloads builtins that were loaded
+void enable_builtin(cmd_t* cmd)
+{
+	param_t* param = cmd->param_list;
+
+	if (param == NULL)
+	{
+		enable_list();
+	}
+	else if (strcmp(param->param, "-f") == 0 && param->next && param->next->next)
+	{
+		const char* path = param->next->param;
+
+		for (param = param->next->next; param; param = param->next)
+		{
+			enable_load(path, param->param);
+		}
+	}
+	else if (strcmp(param->param, "-d") == 0)
+	{
+		for (param = param->next; param; param = param->next)
+		{
+			builtin_t* b = builtin_find(param->param);
+
+			if (b == NULL || b->plugin == NULL)
+			{
+				fprintf(stderr, ENABLE_CMD ": %s: not a loaded builtin\n", param->param);
+				continue;
+			}
+			builtin_remove(b);
+			builtin_unload(b);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "usage: " ENABLE_CMD " [-f lib.so name ...] [-d name ...]\n");
+	}
+
+	return;
+}
+
+
+//unloads every loaded builtin, for when the shell exits
+void builtin_cleanup(void)
+{
+	for (int i = 0; i < BUILTIN_BUCKETS; ++i)
+	{
+		while (table[i])
+		{
+			builtin_t* b = table[i];
+
+			table[i] = b->next;
+			if (b->plugin) builtin_unload(b);
+		}
+	}
+
+	return;
+}
@@ -0,0 +1,43 @@
+//builtin.h
+//Drake Wheeler
+
+#ifndef _BUILTIN_H
+# define _BUILTIN_H
+
+# include "psush_builtin.h"
+
+# define ENABLE_CMD "enable"
+
+# define BUILTIN_BUCKETS 64 //dispatch table size, a power of two
+# define BUILTIN_SYM_SUFFIX "_builtin" //enable -f name looks up name_builtin
+
+struct cmd_s;
+struct cmd_list_s;
+
+// One entry in the dispatch table. Exactly one of run, stage, prefix or
+// plugin says how the builtin is carried out:
+//  run     in the shell, only when it's the whole command line (cd, history)
+//  stage   on fds, so also usable as a pipeline stage without an exec (wc)
+//  prefix  takes the pipeline that follows it (watch, cache)
+//  plugin  loaded with enable -f, runs like a stage
+typedef struct builtin_s {
+    const char *name;
+    void       (*run)(struct cmd_s *cmd);
+    int        (*stage)(struct cmd_s *cmd, int in_fd, int out_fd);
+    void       (*prefix)(struct cmd_list_s *cmds);
+    int        (*takes)(struct cmd_s *cmd); //NULL if any arguments will do
+    const psush_builtin_t *plugin;
+    void       *handle;                     //from dlopen()
+    char       *path;
+    struct builtin_s *next;                 //next in the same bucket
+} builtin_t;
+
+void builtin_init(void);
+builtin_t *builtin_for(struct cmd_s *cmd);
+void builtin_exec(builtin_t *b, struct cmd_s *cmd);
+int builtin_stage(builtin_t *b, struct cmd_s *cmd, int in_fd, int out_fd);
+int builtin_in_shell(builtin_t *b);
+void enable_builtin(struct cmd_s *cmd);
+void builtin_cleanup(void);
+
+#endif // _BUILTIN_H
@@ -0,0 +1,572 @@
+//cache.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for copy_file_range()
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+
+#include "cmd_parse.h"
+#include "cache.h"
+
+#ifndef FICLONE
+# define FICLONE _IOW(0x94, 9, int) //from linux/fs.h, which fights with the libc headers
+#endif // FICLONE
+
+#define FNV_OFFSET 1469598103934665603ULL
+#define FNV_PRIME  1099511628211ULL
+#define CACHE_BUF_SIZE (1 << 18)
+#define CACHE_OUT_EXT    ".out"
+#define CACHE_STATUS_EXT ".status"
+#define CACHE_TMP_PREFIX "tmp."
+#define CACHE_STATS_FILE "stats"
+#define CACHE_PATH_LEN (PATH_MAX + 64)
+
+extern unsigned short is_verbose;
+extern int last_exit_status;
+
+static long long cache_max = CACHE_MAX_BYTES; //set with cache -m
+
+// One stored result, as seen when looking for something to evict.
+// used is the mtime of the status file, which a hit bumps.
+typedef struct cache_ent_s {
+	char            key[NAME_MAX + 1];
+	long long       size;
+	struct timespec used;
+} cache_ent_t;
+
+
+static unsigned long long fnv1a(unsigned long long h, const void* data, size_t len)
+{
+	const unsigned char* p = data;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= p[i];
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+
+//$XDG_CACHE_HOME/psush or ~/.cache/psush, made if it isn't there
+static int cache_dir(char* buf, size_t len)
+{
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+
+	if (xdg && *xdg)
+	{
+		mkdir(xdg, 0700);
+		snprintf(buf, len, "%s/" CACHE_DIR_NAME, xdg);
+	}
+	else if (home && *home)
+	{
+		snprintf(buf, len, "%s/.cache", home);
+		mkdir(buf, 0700);
+		snprintf(buf, len, "%s/.cache/" CACHE_DIR_NAME, home);
+	}
+	else
+	{
+		return -1;
+	}
+	if (mkdir(buf, 0700) != 0 && errno != EEXIST)
+	{
+		fprintf(stderr, "cache: %s: %s\n", buf, strerror(errno));
+		buf[0] = '\0';
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int cache_hash_file(unsigned long long* h, const char* name)
+{
+	char* buf = malloc(CACHE_BUF_SIZE);
+	int fd = open(name, O_RDONLY);
+	ssize_t n = 0;
+
+	if (fd < 0 || buf == NULL)
+	{
+		free(buf);
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+	while ((n = read(fd, buf, CACHE_BUF_SIZE)) > 0)
+	{
+		*h = fnv1a(*h, buf, n);
+	}
+	close(fd);
+	free(buf);
+
+	return n < 0 ? -1 : 0;
+}
+
+
+//hashes who a file is: its device, inode, size, mtime and ctime, or its
+//bytes with by_content
+static int cache_hash_ident(unsigned long long* h, const char* name, const struct stat* st, int by_content)
+{
+	if (by_content) return cache_hash_file(h, name);
+
+	*h = fnv1a(*h, &st->st_dev, sizeof(st->st_dev));
+	*h = fnv1a(*h, &st->st_ino, sizeof(st->st_ino));
+	*h = fnv1a(*h, &st->st_size, sizeof(st->st_size));
+	*h = fnv1a(*h, &st->st_mtim, sizeof(st->st_mtim));
+	*h = fnv1a(*h, &st->st_ctim, sizeof(st->st_ctim));
+
+	return 0;
+}
+
+
+//hashes what decides the output: the directory we're in, every stage and
+//its parameters, here text, and who each < file is. A parameter naming a
+//regular file (cat d.txt) counts as an input the same way.
+//The > file isn't part of it, that's where a hit gets replayed to.
+static int cache_key(cmd_list_t* cmds, int by_content, unsigned long long* key)
+{
+	char cwd[PATH_MAX] = {'\0'};
+	unsigned long long h = FNV_OFFSET;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) return -1;
+	h = fnv1a(h, cwd, strlen(cwd) + 1);
+
+	for (cmd_t* cmd = cmds->head; cmd; cmd = cmd->next)
+	{
+		const char* name = cmd->cmd ? cmd->cmd : "";
+
+		h = fnv1a(h, name, strlen(name) + 1);
+		for (param_t* param = cmd->param_list; param; param = param->next)
+		{
+			struct stat st;
+
+			h = fnv1a(h, param->param, strlen(param->param) + 1);
+			if (stat(param->param, &st) == 0 && S_ISREG(st.st_mode))
+			{
+				if (cache_hash_ident(&h, param->param, &st, by_content) != 0) return -1;
+			}
+		}
+		if (cmd->input_src == REDIRECT_FILE && cmd->input_file_name)
+		{
+			struct stat st;
+
+			if (stat(cmd->input_file_name, &st) != 0) return -1;
+			h = fnv1a(h, cmd->input_file_name, strlen(cmd->input_file_name) + 1);
+			if (cache_hash_ident(&h, cmd->input_file_name, &st, by_content) != 0) return -1;
+		}
+		if (cmd->input_src == REDIRECT_HERE && cmd->here_body)
+		{
+			h = fnv1a(h, cmd->here_body, cmd->here_len);
+		}
+		h = fnv1a(h, PIPE_DELIM, sizeof(PIPE_DELIM));
+	}
+	*key = h;
+
+	return 0;
+}
+
+
+//copies all of in to out. A reflink if out is a file we just truncated and
+//the file system can share blocks, else copy_file_range() so the kernel
+//does it, else sendfile(), which takes any kind of out, and plain
+//read()/write() as the last resort. A reflink always lands at offset 0 and
+//leaves out's offset alone, so it's no good for a stdout that's a file.
+static int cache_copy(int in, int out, int may_clone)
+{
+	struct stat st;
+	long long left = 0;
+	ssize_t n = 0;
+	char* buf = NULL;
+
+	if (fstat(in, &st) != 0) return -1;
+	left = st.st_size;
+	if (left == 0) return 0;
+
+	if (may_clone && ioctl(out, FICLONE, in) == 0) return 0;
+
+	while (left > 0 && (n = copy_file_range(in, NULL, out, NULL, left, 0)) > 0)
+	{
+		left -= n;
+	}
+	while (left > 0 && (n = sendfile(out, in, NULL, left)) > 0)
+	{
+		left -= n;
+	}
+	if (left > 0 && (buf = malloc(CACHE_BUF_SIZE)) != NULL)
+	{
+		while (left > 0 && (n = read(in, buf, CACHE_BUF_SIZE)) > 0)
+		{
+			if (write(out, buf, n) != n) break;
+			left -= n;
+		}
+		free(buf);
+	}
+
+	return left == 0 ? 0 : -1;
+}
+
+
+//writes a stored result to where the pipeline's output was going
+static void cache_replay(const char* path, redir_t dest, const char* dest_name)
+{
+	int in = open(path, O_RDONLY);
+	int out = STDOUT_FILENO;
+
+	if (in < 0)
+	{
+		fprintf(stderr, "cache: %s: %s\n", path, strerror(errno));
+		return;
+	}
+	if (dest == REDIRECT_FILE)
+	{
+		out = open(dest_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0)
+		{
+			fprintf(stderr, "***** output redirection failed %d *****\n", errno);
+			close(in);
+			return;
+		}
+	}
+
+	fflush(stdout);
+	if (cache_copy(in, out, out != STDOUT_FILENO) != 0)
+	{
+		fprintf(stderr, "cache: replay of %s failed %d\n", path, errno);
+	}
+	close(in);
+	if (out != STDOUT_FILENO) close(out);
+
+	return;
+}
+
+
+static void cache_read_stats(const char* dir, unsigned long long* hits, unsigned long long* misses)
+{
+	char path[CACHE_PATH_LEN] = {'\0'};
+	FILE* fp = NULL;
+
+	*hits = *misses = 0;
+	snprintf(path, sizeof(path), "%s/" CACHE_STATS_FILE, dir);
+	fp = fopen(path, "r");
+	if (fp == NULL) return;
+	if (fscanf(fp, "hits %llu misses %llu", hits, misses) != 2) *hits = *misses = 0;
+	fclose(fp);
+
+	return;
+}
+
+
+//hit and miss counts are kept with the cache, so separate shells running
+//report jobs add up to one set of numbers
+static void cache_bump_stats(const char* dir, int hit)
+{
+	char path[CACHE_PATH_LEN] = {'\0'};
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+	FILE* fp = NULL;
+
+	cache_read_stats(dir, &hits, &misses);
+	if (hit) ++hits;
+	else ++misses;
+
+	snprintf(path, sizeof(path), "%s/" CACHE_STATS_FILE, dir);
+	fp = fopen(path, "w");
+	if (fp == NULL) return;
+	fprintf(fp, "hits %llu misses %llu\n", hits, misses);
+	fclose(fp);
+
+	return;
+}
+
+
+//lists every complete entry (one with a status file), oldest use first
+static int cache_scan(const char* dir, cache_ent_t** ents, long long* total)
+{
+	DIR* dp = opendir(dir);
+	struct dirent* de = NULL;
+	char path[CACHE_PATH_LEN] = {'\0'};
+	int count = 0;
+	int cap = 0;
+
+	*ents = NULL;
+	*total = 0;
+	if (dp == NULL) return 0;
+
+	while ((de = readdir(dp)) != NULL)
+	{
+		size_t len = strlen(de->d_name);
+		size_t ext = strlen(CACHE_STATUS_EXT);
+		struct stat st;
+		cache_ent_t* ent = NULL;
+
+		if (len <= ext || strcmp(de->d_name + len - ext, CACHE_STATUS_EXT) != 0) continue;
+		if (count == cap)
+		{
+			cap = cap ? 2 * cap : 64;
+			*ents = realloc(*ents, cap * sizeof(cache_ent_t));
+		}
+		ent = &(*ents)[count];
+		memcpy(ent->key, de->d_name, len - ext);
+		ent->key[len - ext] = '\0';
+
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &st) != 0) continue;
+		ent->used = st.st_mtim;
+		ent->size = st.st_size;
+		snprintf(path, sizeof(path), "%s/%s" CACHE_OUT_EXT, dir, ent->key);
+		if (stat(path, &st) == 0) ent->size += st.st_size;
+		*total += ent->size;
+		++count;
+	}
+	closedir(dp);
+
+	return count;
+}
+
+
+static int cmp_used(const void* a, const void* b)
+{
+	const cache_ent_t* x = a;
+	const cache_ent_t* y = b;
+
+	if (x->used.tv_sec != y->used.tv_sec) return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+	if (x->used.tv_nsec != y->used.tv_nsec) return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+
+static void cache_remove(const char* dir, const char* key)
+{
+	char path[CACHE_PATH_LEN] = {'\0'};
+
+	//status first, so a half removed entry is never taken for a hit
+	snprintf(path, sizeof(path), "%s/%s" CACHE_STATUS_EXT, dir, key);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%s" CACHE_OUT_EXT, dir, key);
+	unlink(path);
+
+	return;
+}
+
+
+//drops least recently used entries until the cache fits in cache_max
+static void cache_evict(const char* dir)
+{
+	cache_ent_t* ents = NULL;
+	long long total = 0;
+	int count = cache_scan(dir, &ents, &total);
+
+	if (total > cache_max)
+	{
+		qsort(ents, count, sizeof(cache_ent_t), cmp_used);
+		for (int i = 0; i < count && total > cache_max; ++i)
+		{
+			if (is_verbose) fprintf(stderr, "verbose: cache: evicting %s\n", ents[i].key);
+			cache_remove(dir, ents[i].key);
+			total -= ents[i].size;
+		}
+	}
+	free(ents);
+
+	return;
+}
+
+
+static void cache_clear(const char* dir)
+{
+	DIR* dp = opendir(dir);
+	struct dirent* de = NULL;
+	char path[CACHE_PATH_LEN] = {'\0'};
+
+	if (dp == NULL) return;
+	while ((de = readdir(dp)) != NULL)
+	{
+		if (de->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	closedir(dp);
+
+	return;
+}
+
+
+static void cache_print_stats(const char* dir)
+{
+	cache_ent_t* ents = NULL;
+	long long total = 0;
+	int count = cache_scan(dir, &ents, &total);
+	unsigned long long hits = 0;
+	unsigned long long misses = 0;
+
+	free(ents);
+	cache_read_stats(dir, &hits, &misses);
+	printf(" cache dir: %s\n", dir);
+	printf(" cache entries: %d, %lld of %lld bytes\n", count, total, cache_max);
+	printf(" cache hits: %llu, misses: %llu (%.1f%% hit)\n", hits, misses
+			, hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+
+	return;
+}
+
+
+//builtins other than wc run in the shell itself and write straight to our
+//stdout, so there's no output to catch; those just run
+static int cache_in_shell(cmd_list_t* cmds)
+{
+	builtin_t* b = builtin_for(cmds->head);
+
+	return b && (b->prefix || (cmds->count == 1 && builtin_in_shell(b)));
+}
+
+
+static int cache_parse_size(const char* str, long long* size)
+{
+	char* end = NULL;
+	long long val = strtoll(str, &end, 10);
+
+	if (end == str || val <= 0) return -1;
+	if (*end == 'k' || *end == 'K') { val <<= 10; ++end; }
+	else if (*end == 'm' || *end == 'M') { val <<= 20; ++end; }
+	else if (*end == 'g' || *end == 'G') { val <<= 30; ++end; }
+	if (*end != '\0') return -1;
+	*size = val;
+
+	return 0;
+}
+
+
+//cache [-c] [-s] [-x] [-m size] command ...
+//replays the stored output and exit status of a pipeline that was run
+//before with the same command line and the same < inputs, or runs it and
+//stores the result. -c keys inputs on their contents rather than inode,
+//size and times, -s shows stats, -x empties the cache and -m sets how big
+//it may get before the least recently used results are dropped.
+void cache_builtin(cmd_list_t* cmds)
+{
+	cmd_t* first = cmds->head;
+	cmd_t* last = cmds->tail;
+	int by_content = 0;
+	int show_stats = 0;
+	int clear = 0;
+	char dir[PATH_MAX] = {'\0'};
+	char out_path[CACHE_PATH_LEN] = {'\0'};
+	char status_path[CACHE_PATH_LEN] = {'\0'};
+	char tmp_path[CACHE_PATH_LEN] = {'\0'};
+	unsigned long long key = 0;
+	redir_t dest = last->output_dest;
+	char* dest_name = last->output_file_name;
+	FILE* fp = NULL;
+	int fd = -1;
+	int status = 0;
+
+	while (first->param_list && first->param_list->param[0] == '-')
+	{
+		char* opt = shift_param(first);
+
+		if (strcmp(opt, "-c") == 0) by_content = 1;
+		else if (strcmp(opt, "-s") == 0) show_stats = 1;
+		else if (strcmp(opt, "-x") == 0) clear = 1;
+		else if (strcmp(opt, "-m") == 0 && first->param_list)
+		{
+			char* val = shift_param(first);
+
+			if (cache_parse_size(val, &cache_max) != 0) fprintf(stderr, "cache: bad size %s\n", val);
+			free(val);
+		}
+		else fprintf(stderr, "cache: unknown option %s\n", opt);
+		free(opt);
+	}
+
+	if (cache_dir(dir, sizeof(dir)) == 0)
+	{
+		if (clear) cache_clear(dir);
+		if (show_stats) cache_print_stats(dir);
+	}
+	if (first->param_list == NULL) return; //just looking after the cache
+
+	//what's left is the pipeline
+	free(first->cmd);
+	first->cmd = shift_param(first);
+
+	if (dir[0] == '\0' || cache_in_shell(cmds) || cache_key(cmds, by_content, &key) != 0)
+	{
+		//no cache dir, a builtin, or an input we can't see; let the pipeline complain
+		exec_commands(cmds);
+		return;
+	}
+	snprintf(out_path, sizeof(out_path), "%s/%016llx" CACHE_OUT_EXT, dir, key);
+	snprintf(status_path, sizeof(status_path), "%s/%016llx" CACHE_STATUS_EXT, dir, key);
+
+	fp = fopen(status_path, "r");
+	if (fp && fscanf(fp, "%d", &status) == 1 && access(out_path, R_OK) == 0)
+	{
+		fclose(fp);
+		if (is_verbose) fprintf(stderr, "verbose: cache hit %016llx\n", key);
+		cache_replay(out_path, dest, dest_name);
+		utimensat(AT_FDCWD, status_path, NULL, 0); //most recently used
+		cache_bump_stats(dir, 1);
+		last_exit_status = status;
+		return;
+	}
+	if (fp) fclose(fp);
+
+	//a miss: run it with the output going to a file in the cache
+	if (is_verbose) fprintf(stderr, "verbose: cache miss %016llx\n", key);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/" CACHE_TMP_PREFIX "XXXXXX", dir);
+	fd = mkstemp(tmp_path);
+	if (fd < 0)
+	{
+		perror("cache: mkstemp");
+		exec_commands(cmds);
+		return;
+	}
+	close(fd);
+
+	//on the heap, since stages that exit without exec free the cmd list
+	last->output_dest = REDIRECT_FILE;
+	last->output_file_name = strdup(tmp_path);
+	exec_commands(cmds);
+	free(last->output_file_name);
+	last->output_dest = dest;
+	last->output_file_name = dest_name;
+	status = last_exit_status;
+
+	//killed, most likely by Ctrl-C, or the command wasn't there to run; show
+	//what we got but keep none of it
+	if (status > 128 || status == EXEC_FAILED)
+	{
+		cache_replay(tmp_path, dest, dest_name);
+		unlink(tmp_path);
+		return;
+	}
+	if (rename(tmp_path, out_path) != 0)
+	{
+		perror("cache: rename");
+		cache_replay(tmp_path, dest, dest_name);
+		unlink(tmp_path);
+		return;
+	}
+	fp = fopen(status_path, "w");
+	if (fp)
+	{
+		fprintf(fp, "%d\n", status);
+		fclose(fp);
+	}
+	cache_bump_stats(dir, 0);
+	cache_replay(out_path, dest, dest_name);
+	cache_evict(dir);
+
+	return;
+}
@@ -0,0 +1,16 @@
+//cache.h
+//Drake Wheeler
+
+#ifndef _CACHE_H
+# define _CACHE_H
+
+# define CACHE_CMD "cache"
+
+# define CACHE_DIR_NAME "psush"            //under $XDG_CACHE_HOME or ~/.cache
+# define CACHE_MAX_BYTES (256L << 20)     //default size before LRU eviction
+
+struct cmd_list_s;
+
+void cache_builtin(struct cmd_list_s *cmds);
+
+#endif // _CACHE_H
@@ -25,6 +25,8 @@ unsigned short is_verbose = 0;
 static char* history[HIST_SIZE] = {NULL}; //array to store command history
 static int history_count = 0; //number of commands currently stored
 pid_t current_child_pid = 0; //global variable to track child PID
+volatile sig_atomic_t got_sigint = 0; //set by Ctrl-C, for builtins running in the shell
+int last_exit_status = 0; //exit status of the last stage of the last pipeline
 
 int process_user_input_simple(void)
 {
@@ -38,9 +40,12 @@ int process_user_input_simple(void)
 	char host_name[MAXHOSTNAMELEN] = {'\0'};
 
 	signal(SIGINT, sigint_handler); //set up signal handler for sigint
+	builtin_init();
 
     for ( ; ; ) 
 	{
+		got_sigint = 0; //a Ctrl-C at the last prompt is old news
+
 		//get current working directory
 		if (getcwd(current_directory, sizeof(current_directory)) == NULL)
 		{
@@ -98,6 +103,7 @@ int process_user_input_simple(void)
 
         // Basic commands are pipe delimited.
         // This is really for Stage 2.
+		here_protect(str); //a | in quoted here text isn't a pipe
         raw_cmd = strtok(str, PIPE_DELIM);
 
         cmd_list = (cmd_list_t *) calloc(1, sizeof(cmd_list_t));
@@ -147,6 +153,8 @@ int process_user_input_simple(void)
 	{
 		free(history[i]);
 	}
+	pin_cleanup();
+	builtin_cleanup();
 
     return(EXIT_SUCCESS);
 }
@@ -161,18 +169,46 @@ void sigint_handler(__attribute__ ((unused)) int sig)
 		kill(current_child_pid, SIGINT); //forward kill signal to child process
 	}
 
-	//if no child process ignore the signal
+	//a builtin running in the shell looks at this to stop early
+	got_sigint = 1;
+
+	return;
+}
+
+
+//frees everything the shell owns, for a forked child that is about to exit
+//without exec'ing (a failed execvp, a pipe relay or a watch run)
+void child_cleanup(cmd_list_t* cmd_list)
+{
+	//free history array
+	for (int j = 0; j < history_count; ++j)
+	{
+		free(history[j]);
+	}
+	pin_cleanup();
+	free_list(cmd_list);
 
 	return;
 }
 
 
 //to execute non built in commands, singular or multiple
+//every stage is started before any is waited on, so stages run side by side
+//and a stage writing more than a pipe holds can't stall the whole line
 void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 {
 	int p_trail = -1; //set the file descriptor to the previous pipes read-end to -1 to idicate there's no previous pipe
 	int P[2] = {-1, -1}; //file descriptors for pipe
 	pid_t pid; //process ID
+	pid_t* pids = calloc(2 * cmd_list->count, sizeof(pid_t)); //stages plus relays
+	int pid_count = 0;
+	pid_t last_pid = 0; //the stage whose status the pipeline reports
+	pipe_stat_t* stats = pipes_meter_begin(cmd_list->count - 1); //NULL unless metering
+	builtin_t* builtin = NULL;
+
+	//anything still buffered would be written again by every child that exits
+	fflush(stdout);
+	fflush(stderr);
 
 	//loop for each command in the list
 	while(cmd)
@@ -186,6 +222,7 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 				perror("pipe failed");
 				exit(EXIT_FAILURE);
 			}
+			pipes_set_size(P[1], cmd->pipe_size);
 		};
 		
 		pid = fork(); //fork a new process
@@ -199,6 +236,10 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 		{
 			//reset SIGINT handling to default
 			signal(SIGINT, SIG_DFL);
+			got_sigint = 0;
+
+			//cpu affinity, nice, ionice and memory policy for this stage
+			placement_apply(&cmd->place, cmd->list_location);
 
 			//if this is the first command, and input needs to be redirected
 			if (p_trail == -1 && cmd->input_src == REDIRECT_FILE)
@@ -213,6 +254,18 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 				dup2(fd_in, STDIN_FILENO); //redirect standard input to file descriptor of opened file
 				close(fd_in); //close the file descriptor after redirection
 			}
+			else if (p_trail == -1 && cmd->input_src == REDIRECT_HERE) //here-string or here-document
+			{
+				int fd_in = here_open(cmd->here_body, cmd->here_len);
+
+				if (fd_in < 0)
+				{
+					fprintf(stderr, "***** input redirection failed %d *****\n", errno);
+					exit(7);
+				}
+				dup2(fd_in, STDIN_FILENO);
+				close(fd_in);
+			}
 			else if (p_trail != -1) //if not first command, reirect previous pipe's read-from end to stdin
             {
                 dup2(p_trail, STDIN_FILENO); //redirect standard input to previous pipe's read-from end
@@ -239,6 +292,16 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 				close(P[0]); //close the pipes read-from end descriptor
 			}
 
+			//wc and loaded builtins run right here on the wired fds, no exec needed
+			if ((builtin = builtin_for(cmd)) && !builtin_in_shell(builtin))
+			{
+				int ret = builtin_stage(builtin, cmd, STDIN_FILENO, STDOUT_FILENO);
+
+				free(pids);
+				child_cleanup(cmd_list);
+				exit(ret);
+			}
+
 			//build arg for execvp()
 			{
 				int i = 1; //start filling arguments after the first element which is the command
@@ -262,49 +325,61 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 
 				//if execcvp fails the following code will execute
 				fprintf(stderr, "%s: command not found\n", cmd->cmd); //if execvp returns, it's an error
-				{
-					//free history array
-					for (int j = 0; j < history_count; ++j)
-					{
-						free(history[j]);
-					}
-				}
 
-				free_list(cmd_list);
-				//free allocated memory for argv
-				for (int j = 0; j < argc; ++j)
-				{
-					free(argv[j]);
-				}
+				//the strings in argv belong to cmd_list, only the array is ours
 				free(argv);
-				exit(EXIT_FAILURE); //only reaches here if execvp failed
+				free(pids);
+				child_cleanup(cmd_list);
+				exit(EXEC_FAILED); //only reaches here if execvp failed
 			}
 		}
 		else if (pid > 0) //parent process
 		{
-			int status; //exit status of child process
-			current_child_pid = pid; //store child PID for signal handling
-			waitpid(pid, &status, 0); //wait for the child process to complete
-			current_child_pid = 0; //reset after child terminates
-								   
+			pids[pid_count++] = pid;
+			if (!cmd->next) last_pid = pid;
 
 			//if not first command, close previous read end
 			if (p_trail != -1) close(p_trail);
+			p_trail = -1;
 
 			if(cmd->next) //if there is anothe comman in the pipe
 			{
 				close(P[1]); //close the current pipe's write-to end in the parent
 				p_trail = P[0]; //update p_trail to the current pipe's read-from end for the next command
 			}
-			else if (P[0] >= 0) //if this is the last command and the pipe was used, close the current pipe's read end
-			{
-				close(P[0]);
-			}
 
-			//if the child process was termined by a signal
-			if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+			//metering puts a relay between this stage and the next one
+			if (cmd->next && stats)
 			{
-				printf("child killed\n");
+				int Q[2] = {-1, -1};
+
+				if (pipe(Q) == -1)
+				{
+					perror("pipe failed");
+					exit(EXIT_FAILURE);
+				}
+				pipes_set_size(Q[1], cmd->pipe_size);
+
+				pid = fork();
+				if (pid == -1)
+				{
+					perror("fork failed");
+					exit(EXIT_FAILURE);
+				}
+				if (pid == 0) //relay process
+				{
+					close(Q[0]);
+					pipe_relay(P[0], Q[1], &stats[cmd->list_location]);
+					close(P[0]);
+					close(Q[1]);
+					free(pids);
+					child_cleanup(cmd_list);
+					exit(EXIT_SUCCESS);
+				}
+				pids[pid_count++] = pid;
+				close(P[0]);
+				close(Q[1]);
+				p_trail = Q[0]; //next stage reads what the relay hands on
 			}
 		}
 		else
@@ -315,6 +390,28 @@ void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list)
 		cmd = cmd->next; //move to next command in the list
 	}
 
+	//reap every stage and relay, in pipeline order
+	for (int i = 0; i < pid_count; ++i)
+	{
+		int status; //exit status of child process
+		current_child_pid = pids[i]; //store child PID for signal handling
+		waitpid(pids[i], &status, 0); //wait for the child process to complete
+		current_child_pid = 0; //reset after child terminates
+
+		if (pids[i] == last_pid)
+		{
+			last_exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		}
+
+		//if the child process was termined by a signal
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+		{
+			printf("child killed\n");
+		}
+	}
+	pipes_meter_end(stats, cmd_list);
+	free(pids);
+
 	return;
 }
 
@@ -390,6 +487,14 @@ void simple_argv(int argc, char *argv[] )
 void exec_commands(cmd_list_t* cmds ) 
 {
     cmd_t* cmd = cmds->head;
+	builtin_t* builtin = builtin_for(cmd);
+
+	//watch and cache take the whole pipeline, not just the first command
+	if (builtin && builtin->prefix)
+	{
+		builtin->prefix(cmds);
+		return;
+	}
 
     if (cmds->count == 1) 
 	{
@@ -399,62 +504,12 @@ void exec_commands(cmd_list_t* cmds )
             return;
         }
 
-		//if command is "bye" exit program
-		if (strcmp(cmd->cmd, BYE_CMD) == 0) exit(EXIT_SUCCESS);
-
-		//chcek for built in commands
-
-        if (strcmp(cmd->cmd, CD_CMD) == 0) //if command is "cd ..."
-		{
-            if (cmd->param_count == 0) 
-			{
-                // Just a "cd" on the command line without a target directory
-                // need to cd to the HOME directory.
-
-                // Is there an environment variable, somewhere, that contains
-                // the HOME directory that could be used as an argument to
-                // the chdir() fucntion?
-				if(chdir(getenv("HOME")) != 0) //go to home directory
-				{
-					perror("cd failed");
-				}
-            }
-            else 
-			{
-                // try and cd to the target directory. It would be good to check
-                // for errors here.
-                if (chdir(cmd->param_list->param) != 0) 
-				{
-                    // a sad chdir.  :-(
-					if(is_verbose) perror("cd failed");
-                }
-            }
-        }
-        else if (strcmp(cmd->cmd, CWD_CMD) == 0) 
-		{
-            char str[MAXPATHLEN];
-
-            // Fetch the Current Working Wirectory (CWD).
-            // aka - get country western dancing
-            getcwd(str, MAXPATHLEN); 
-            printf(" " CWD_CMD ": %s\n", str);
-        }
-        else if (strcmp(cmd->cmd, ECHO_CMD) == 0) 
+		//check for built in commands, one lookup in the dispatch table. A
+		//stage builtin with placement runs forked so the settings land on it.
+		if (builtin && (builtin_in_shell(builtin) || !placement_wanted(&cmd->place)))
 		{
-			param_t* param = cmd->param_list; //set a pointer to the parameter list
-											  
-			while(param) //loop through the list
-			{
-				printf("%s ", param->param); //print each parameter with a space
-				param = param->next; //go to next parameter in the list
-			}
-			printf("\n"); //end with a newline
-        }
-        else if (0 == strcmp(cmd->cmd, HISTORY_CMD)) 
-		{
-            // display the history here
-			display_history();
-        }
+			builtin_exec(builtin, cmd);
+		}
         else 
 		{
 			execute_external_command(cmd, cmds);
@@ -511,6 +566,25 @@ void print_list(cmd_list_t *cmd_list)
 }
 
 
+//takes the first parameter off cmd and hands back its string, which the
+//caller now owns. Used by prefixes like watch and cache to peel themselves
+//and their options off the real command.
+char* shift_param(cmd_t* cmd)
+{
+	param_t* param = cmd->param_list;
+	char* str = NULL;
+
+	if (param == NULL) return NULL;
+
+	str = param->param;
+	cmd->param_list = param->next;
+	--cmd->param_count;
+	free(param);
+
+	return str;
+}
+
+
 //frees all members in cmd_t struct
 void free_cmd(cmd_t *cmd)
 {
@@ -524,6 +598,10 @@ void free_cmd(cmd_t *cmd)
 
 	if (cmd->output_file_name) free(cmd->output_file_name);
 
+	if (cmd->here_body) free(cmd->here_body);
+
+	free_place(&cmd->place);
+
 	//loop through param list
 	while(cmd->param_list)
 	{
@@ -563,7 +641,8 @@ void print_cmd(cmd_t *cmd)
 
     fprintf(stderr,"\tinput source: %s\n"
             , (cmd->input_src == REDIRECT_FILE ? "redirect file" :
-               (cmd->input_src == REDIRECT_PIPE ? "redirect pipe" : "redirect none")));
+               (cmd->input_src == REDIRECT_PIPE ? "redirect pipe" :
+                (cmd->input_src == REDIRECT_HERE ? "redirect here" : "redirect none"))));
     fprintf(stderr,"\toutput dest:  %s\n"
             , (cmd->output_dest == REDIRECT_FILE ? "redirect file" :
                (cmd->output_dest == REDIRECT_PIPE ? "redirect pipe" : "redirect none")));
@@ -571,7 +650,10 @@ void print_cmd(cmd_t *cmd)
             , (NULL == cmd->input_file_name ? "<na>" : cmd->input_file_name));
     fprintf(stderr,"\toutput file name: %s\n"
             , (NULL == cmd->output_file_name ? "<na>" : cmd->output_file_name));
+    fprintf(stderr,"\there text length: %zu\n", cmd->here_len);
     fprintf(stderr,"\tlocation in list of commands: %d\n", cmd->list_location);
+    placement_print(stderr, &cmd->place, "\tplacement ");
+    fprintf(stderr,"\toutput pipe size: %ld\n", cmd->pipe_size);
     fprintf(stderr,"\n");
 }
 
@@ -602,6 +684,10 @@ void parse_commands(cmd_list_t *cmd_list)
         // It's like double exciting.
         stralloca(raw, cmd->raw_cmd);
 
+        // Pull out any <<< or << first. It takes quoted text with
+        // spaces in it, which strtok() below would chop up.
+        here_parse(raw, cmd);
+
         arg = strtok(raw, SPACE_DELIM);
         if (NULL == arg) {
             // The way I've done this is like ya'know way UGLY.
@@ -624,7 +710,7 @@ void parse_commands(cmd_list_t *cmd_list)
         }
         cmd->cmd = strdup(arg);
         // Initialize these to the default values.
-        cmd->input_src = REDIRECT_NONE;
+        cmd->input_src = (cmd->here_body ? REDIRECT_HERE : REDIRECT_NONE);
         cmd->output_dest = REDIRECT_NONE;
 
         while ((arg = strtok(NULL, SPACE_DELIM)) != NULL) {
@@ -656,6 +742,12 @@ void parse_commands(cmd_list_t *cmd_list)
                 cmd->output_file_name = strdup(strtok(NULL, SPACE_DELIM));
                 cmd->output_dest = REDIRECT_FILE;
             }
+            else if (arg[0] == PLACE_PREFIX
+                     && (placement_parse_token(&cmd->place, arg + 1) != 0
+                         || pipes_parse_token(&cmd->pipe_size, arg + 1) != 0)) {
+                // a per stage annotation such as @cpus=2-3 or @pipe=1m,
+                // it never shows up in the argv of the command.
+            }
             else {
                 // add next param
                 param_t *param = (param_t *) calloc(1, sizeof(param_t));
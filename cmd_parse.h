@@ -4,6 +4,14 @@
 #ifndef _CMD_PARSE_H
 # define _CMD_PARSE_H
 
+# include "placement.h"
+# include "pipes.h"
+# include "wc.h"
+# include "heredoc.h"
+# include "watch.h"
+# include "cache.h"
+# include "builtin.h"
+
 # define MAX_STR_LEN 2000
 
 # define CD_CMD  "cd"
@@ -20,12 +28,15 @@
 
 # define PROMPT_STR "PSUsh"
 
+# define EXEC_FAILED 127 //exit status of a stage whose command could not be run, as in sh
+
 // This enumeration is used when determining if the re direction
 // characters (the < and >) were used on a command.
 typedef enum {
     REDIRECT_NONE
     , REDIRECT_FILE
     , REDIRECT_PIPE
+    , REDIRECT_HERE
     , BACKGROUND_PROC
 } redir_t;
 
@@ -45,7 +56,11 @@ typedef struct cmd_s {
     redir_t output_dest;
     char    *input_file_name;
     char    *output_file_name;
+    char    *here_body;    // <<< or << text fed to stdin
+    size_t  here_len;
     int     list_location; // zero based
+    place_t place;         // cpu/nice/ionice/NUMA settings from @ annotations
+    long    pipe_size;     // capacity of the pipe this stage writes, 0 for default
     struct cmd_s *next;
 } cmd_t;
 
@@ -66,6 +81,8 @@ void simple_argv(int argc, char *argv[]);
 void display_history(void);
 void update_history(const char* new_command);
 void execute_external_command(cmd_t* cmd, cmd_list_t* cmd_list);
+void child_cleanup(cmd_list_t* cmd_list);
+char* shift_param(cmd_t* cmd);
 void sigint_handler(__attribute__ ((unused)) int sig);
 
 
@@ -0,0 +1,197 @@
+//heredoc.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for vmsplice(), memfd_create() and F_SETPIPE_SZ
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "cmd_parse.h"
+#include "heredoc.h"
+
+#define HERE_MEMFD_NAME "psush-here"
+#define HERE_PIPE_MAX (1 << 20) //biggest pipe we'll grow for a body, the default pipe-max-size
+
+
+//appends len bytes of str and a newline to the body being built
+static void here_append(cmd_t* cmd, const char* str, size_t len)
+{
+	cmd->here_body = realloc(cmd->here_body, cmd->here_len + len + 2);
+	memcpy(cmd->here_body + cmd->here_len, str, len);
+	cmd->here_len += len;
+	cmd->here_body[cmd->here_len++] = '\n';
+	cmd->here_body[cmd->here_len] = '\0';
+
+	return;
+}
+
+
+//reads lines from the user until one is exactly delim
+static void here_doc_read(cmd_t* cmd, const char* delim)
+{
+	char line[MAX_STR_LEN] = {'\0'};
+
+	for ( ; ; )
+	{
+		size_t len = 0;
+
+		if (isatty(fileno(stdout))) fputs(HERE_DOC_PROMPT, stdout);
+		if (fgets(line, MAX_STR_LEN, stdin) == NULL)
+		{
+			fprintf(stderr, "***** here-document ended by end of file, wanted %s *****\n", delim);
+			break;
+		}
+		len = strlen(line);
+		if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+		if (strcmp(line, delim) == 0) break;
+		here_append(cmd, line, len);
+	}
+	if (cmd->here_body == NULL) cmd->here_body = calloc(1, 1); //empty, but still a here-document
+
+	return;
+}
+
+
+//the command line is split on | before any command is parsed, so a | in a
+//quoted here-string (cat <<< "a|b") is swapped for HERE_PIPE_MASK until
+//here_parse() has the text. An unquoted word ends at a |, like in bash.
+void here_protect(char* line)
+{
+	char* p = line;
+
+	while ((p = strstr(p, REDIR_HERE_STR)) != NULL)
+	{
+		char quote = '\0';
+
+		p += strlen(REDIR_HERE_STR);
+		while (*p == ' ') ++p;
+		if (*p != '\'' && *p != '"') continue;
+		quote = *p++;
+		for ( ; *p && *p != quote; ++p)
+		{
+			if (*p == PIPE_DELIM[0]) *p = HERE_PIPE_MASK;
+		}
+	}
+
+	return;
+}
+
+
+//looks for <<< word, <<< "some text" or <<DELIM in raw. The body is kept in
+//cmd and the redirection is blanked out of raw so the tokenizer never sees it.
+void here_parse(char* raw, cmd_t* cmd)
+{
+	char* start = strstr(raw, REDIR_HERE_STR);
+	int is_doc = 0;
+	char* p = NULL;
+	char* word = NULL;
+	char* end = NULL;
+	char quote = '\0';
+
+	if (start == NULL)
+	{
+		start = strstr(raw, REDIR_HERE_DOC);
+		if (start == NULL) return;
+		is_doc = 1;
+	}
+	p = start + (is_doc ? strlen(REDIR_HERE_DOC) : strlen(REDIR_HERE_STR));
+	while (*p == ' ') ++p;
+
+	//the word, up to a matching quote or the next space
+	if (*p == '\'' || *p == '"') quote = *p++;
+	word = p;
+	if (quote) end = strchr(p, quote);
+	else end = strchr(p, ' ');
+	if (end == NULL) end = p + strlen(p);
+
+	free(cmd->here_body);
+	cmd->here_body = NULL;
+	cmd->here_len = 0;
+	if (is_doc)
+	{
+		char* delim = strndup(word, end - word);
+
+		here_doc_read(cmd, delim);
+		free(delim);
+	}
+	else
+	{
+		here_append(cmd, word, end - word);
+		for (char* c = cmd->here_body; *c; ++c)
+		{
+			if (*c == HERE_PIPE_MASK) *c = PIPE_DELIM[0]; //put back what here_protect() hid
+		}
+	}
+
+	if (quote && *end == quote) ++end;
+	memset(start, ' ', end - start);
+
+	return;
+}
+
+
+//returns a descriptor the body can be read from. Bodies that fit in a pipe
+//are vmsplice()d straight from our memory into one; anything bigger goes
+//into an unlinked memfd. Neither touches the disk or needs a helper process.
+//vmsplice() hands the pipe our pages rather than a copy, which is safe here
+//because the body isn't changed or freed until every stage has been reaped.
+int here_open(const char* body, size_t len)
+{
+	int P[2] = {-1, -1};
+	int fd = -1;
+	size_t done = 0;
+	size_t page = sysconf(_SC_PAGESIZE);
+	//vmsplice() takes a pipe slot for every page the body touches, so the
+	//pipe needs room for those pages, not just len bytes. Too few slots and
+	//it blocks with nobody left to read.
+	size_t need = ((uintptr_t) body % page + len + page - 1) / page * page;
+
+	if (pipe(P) == -1) return -1;
+	if (need <= (size_t) fcntl(P[1], F_GETPIPE_SZ)
+		|| (need <= HERE_PIPE_MAX && fcntl(P[1], F_SETPIPE_SZ, (int) need) != -1))
+	{
+		while (done < len)
+		{
+			struct iovec iov = {(void*) (body + done), len - done};
+			ssize_t n = vmsplice(P[1], &iov, 1, 0);
+
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				close(P[0]);
+				close(P[1]);
+				return -1;
+			}
+			done += n;
+		}
+		close(P[1]); //reader sees end of file after the body
+		return P[0];
+	}
+	close(P[0]);
+	close(P[1]);
+
+	fd = memfd_create(HERE_MEMFD_NAME, 0);
+	if (fd < 0) return -1;
+	while (done < len)
+	{
+		ssize_t n = write(fd, body + done, len - done);
+
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	lseek(fd, 0, SEEK_SET);
+
+	return fd;
+}
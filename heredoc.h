@@ -0,0 +1,20 @@
+//heredoc.h
+//Drake Wheeler
+
+#ifndef _HEREDOC_H
+# define _HEREDOC_H
+
+# include <stddef.h>
+
+# define REDIR_HERE_STR "<<<"
+# define REDIR_HERE_DOC "<<"
+# define HERE_DOC_PROMPT "> "
+# define HERE_PIPE_MASK '\x1f' //stands in for | inside quoted here text
+
+struct cmd_s;
+
+void here_protect(char *line);
+void here_parse(char *raw, struct cmd_s *cmd);
+int here_open(const char *body, size_t len);
+
+#endif // _HEREDOC_H
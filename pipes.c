@@ -0,0 +1,241 @@
+//pipes.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for splice(), F_SETPIPE_SZ and F_GETPIPE_SZ
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "cmd_parse.h"
+#include "pipes.h"
+
+#define RELAY_CHUNK (1 << 20) //most bytes asked of one splice()
+#define NS_PER_SEC 1000000000ULL
+
+extern unsigned short is_verbose;
+
+static long pipe_size = 0; //global pipe capacity, 0 leaves the kernel default
+static int pipe_meter = 0; //relay between stages and count bytes and stalls
+
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+
+//parses sizes like 65536, 256k or 1m, returns -1 if malformed. F_SETPIPE_SZ
+//takes an int, so anything past INT_MAX is refused rather than truncated.
+static int parse_size(const char* str, long* size)
+{
+	char* end = NULL;
+	int shift = 0;
+	long val = 0;
+
+	errno = 0;
+	val = strtol(str, &end, 10);
+	if (end == str || val <= 0 || errno == ERANGE) return -1;
+	if (*end == 'k' || *end == 'K') { shift = 10; ++end; }
+	else if (*end == 'm' || *end == 'M') { shift = 20; ++end; }
+	if (*end != '\0' || val > (INT_MAX >> shift)) return -1;
+	val <<= shift;
+	*size = val;
+
+	return 0;
+}
+
+
+//parses @pipe=SIZE, returns 1 if tok was a pipe key, 0 if not and -1 if bad
+int pipes_parse_token(long* size, const char* tok)
+{
+	if (strncmp(tok, PIPE_SIZE_KEY, strlen(PIPE_SIZE_KEY)) != 0) return 0;
+
+	if (parse_size(tok + strlen(PIPE_SIZE_KEY), size) != 0)
+	{
+		fprintf(stderr, "***** bad pipe size: %s *****\n", tok);
+		return -1;
+	}
+
+	return 1;
+}
+
+
+//sets the capacity of the pipe behind fd, the stage's own size wins over
+//the global one. The kernel rounds up to a power of two pages.
+void pipes_set_size(int fd, long stage_size)
+{
+	long size = stage_size ? stage_size : pipe_size;
+
+	if (size == 0) return;
+
+	if (fcntl(fd, F_SETPIPE_SZ, (int) size) == -1)
+	{
+		//EPERM means the size is over /proc/sys/fs/pipe-max-size
+		fprintf(stderr, "***** pipe size %ld failed %d *****\n", size, errno);
+	}
+	else if (is_verbose)
+	{
+		fprintf(stderr, "verbose: pipe capacity %d\n", fcntl(fd, F_GETPIPE_SZ));
+	}
+
+	return;
+}
+
+
+//returns shared counters for pipe_count pipes, or NULL if not metering
+pipe_stat_t* pipes_meter_begin(int pipe_count)
+{
+	pipe_stat_t* stats = NULL;
+
+	if (!pipe_meter || pipe_count <= 0) return NULL;
+
+	stats = mmap(NULL, pipe_count * sizeof(pipe_stat_t), PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED)
+	{
+		perror("pipes: mmap");
+		return NULL;
+	}
+
+	return stats;
+}
+
+
+//prints one line per pipe once every stage and relay has been reaped
+void pipes_meter_end(pipe_stat_t* stats, cmd_list_t* cmd_list)
+{
+	cmd_t* cmd = cmd_list->head;
+
+	if (stats == NULL) return;
+
+	for (int i = 0; cmd && cmd->next; ++i, cmd = cmd->next)
+	{
+		pipe_stat_t* s = &stats[i];
+		double secs = (double) s->wall_ns / NS_PER_SEC;
+
+		fprintf(stderr, "pipe %d %s -> %s: %llu bytes, %d KiB pipe, %.3f ms upstream wait"
+				", %.3f ms downstream wait, %.1f MB/s\n"
+				, i, cmd->cmd, cmd->next->cmd ? cmd->next->cmd : "<na>", s->bytes
+				, s->capacity >> 10, s->starve_ns / 1e6, s->blocked_ns / 1e6
+				, secs > 0 ? s->bytes / secs / 1e6 : 0.0);
+	}
+	munmap(stats, (cmd_list->count - 1) * sizeof(pipe_stat_t));
+
+	return;
+}
+
+
+//runs in its own process between two stages. Moves everything from in to out
+//with splice(), so the data never comes into user space. When a splice would
+//block, poll() tells us which side we were waiting on and for how long.
+void pipe_relay(int in, int out, pipe_stat_t* stat)
+{
+	unsigned long long start = 0;
+
+	signal(SIGPIPE, SIG_IGN); //a reader that quit shows up as EPIPE
+	stat->capacity = fcntl(out, F_GETPIPE_SZ);
+
+	for ( ; ; )
+	{
+		ssize_t n = splice(in, NULL, out, NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (n > 0)
+		{
+			if (start == 0) start = now_ns();
+			stat->bytes += n;
+			continue;
+		}
+		if (n == 0) break; //writer closed its end
+
+		if (errno == EAGAIN)
+		{
+			struct pollfd pfd = {in, POLLIN, 0};
+			unsigned long long t0 = 0;
+
+			if (poll(&pfd, 1, 0) == 0) //nothing to read, upstream is slow
+			{
+				t0 = now_ns();
+				poll(&pfd, 1, -1);
+				if (start) stat->starve_ns += now_ns() - t0;
+			}
+			else //input is waiting so the output pipe is full
+			{
+				pfd.fd = out;
+				pfd.events = POLLOUT;
+				t0 = now_ns();
+				poll(&pfd, 1, -1);
+				stat->blocked_ns += now_ns() - t0;
+			}
+		}
+		else if (errno != EINTR)
+		{
+			if (errno != EPIPE) perror("pipes: splice");
+			break;
+		}
+	}
+	if (start) stat->wall_ns = now_ns() - start;
+
+	return;
+}
+
+
+//pipes                  show the current settings
+//pipes size=N[k|m]      capacity for every pipe in a pipeline
+//pipes size=default     go back to the kernel default
+//pipes meter=on|off     count bytes and stall time per pipe
+void pipes_builtin(cmd_t* cmd)
+{
+	param_t* param = cmd->param_list;
+
+	if (param == NULL)
+	{
+		if (pipe_size) printf(" pipes size: %ld\n", pipe_size);
+		else printf(" pipes size: default\n");
+		printf(" pipes meter: %s\n", pipe_meter ? "on" : "off");
+		return;
+	}
+
+	while (param)
+	{
+		const char* arg = param->param;
+
+		if (strncmp(arg, PIPES_SIZE, strlen(PIPES_SIZE)) == 0)
+		{
+			const char* val = arg + strlen(PIPES_SIZE);
+
+			if (strcmp(val, "default") == 0) pipe_size = 0;
+			else if (parse_size(val, &pipe_size) != 0)
+			{
+				fprintf(stderr, "pipes: bad size %s\n", val);
+			}
+		}
+		else if (strcmp(arg, PIPES_METER "on") == 0)
+		{
+			pipe_meter = 1;
+		}
+		else if (strcmp(arg, PIPES_METER "off") == 0)
+		{
+			pipe_meter = 0;
+		}
+		else
+		{
+			fprintf(stderr, "pipes: unknown option %s\n", arg);
+		}
+		param = param->next;
+	}
+
+	return;
+}
@@ -0,0 +1,35 @@
+//pipes.h
+//Drake Wheeler
+
+#ifndef _PIPES_H
+# define _PIPES_H
+
+# define PIPES_CMD "pipes"
+
+// Per stage annotation that sizes the pipe the stage writes into, @pipe=1m.
+// The pipes builtin takes size= and meter= (pipes size=256k meter=on).
+# define PIPE_SIZE_KEY  "pipe="
+# define PIPES_SIZE     "size="
+# define PIPES_METER    "meter="
+
+// Counters for one metered pipe. These live in shared memory so the
+// relay process can fill them in and the shell can print them.
+typedef struct pipe_stat_s {
+    unsigned long long bytes;       // bytes moved from stage i to stage i+1
+    unsigned long long starve_ns;   // relay waiting on the writer (upstream slow)
+    unsigned long long blocked_ns;  // relay waiting on the reader (backpressure)
+    unsigned long long wall_ns;     // first byte to end of file
+    int capacity;                   // pipe capacity in bytes
+} pipe_stat_t;
+
+struct cmd_s;
+struct cmd_list_s;
+
+int pipes_parse_token(long *size, const char *tok);
+void pipes_set_size(int fd, long stage_size);
+pipe_stat_t *pipes_meter_begin(int pipe_count);
+void pipes_meter_end(pipe_stat_t *stats, struct cmd_list_s *cmd_list);
+void pipe_relay(int in, int out, pipe_stat_t *stat);
+void pipes_builtin(struct cmd_s *cmd);
+
+#endif // _PIPES_H
@@ -0,0 +1,413 @@
+//placement.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for cpu_set_t, sched_setaffinity(), sched_getcpu()
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+
+#include "cmd_parse.h"
+#include "placement.h"
+
+//ioprio_set() and set_mempolicy() have no glibc wrappers, so the constants
+//are spelled out here instead of pulling in libnuma
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_RT    1
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif // MPOL_PREFERRED
+#define MAX_NUMA_NODES 1024
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+extern unsigned short is_verbose;
+
+static place_t pin_default = {NULL, 0, 0, 0, 0, 0, 0}; //settings from the pin builtin
+static int pin_auto = 0; //place adjacent stages on sibling cores
+static int auto_cpus[CPU_SETSIZE]; //cpu for stage i is auto_cpus[i % auto_count]
+static int auto_count = 0;
+
+//one entry per cpu when ordering them for auto placement
+typedef struct cpu_topo_s {
+	int cpu;
+	int package;
+	int core;
+} cpu_topo_t;
+
+
+//parses a cpu list such as "0-3,8,10-11" into set, returns -1 if malformed
+static int parse_cpu_list(const char* list, cpu_set_t* set)
+{
+	const char* p = list;
+
+	CPU_ZERO(set);
+	while (*p)
+	{
+		char* end = NULL;
+		long first = strtol(p, &end, 10);
+		long last = first;
+
+		if (end == p || first < 0 || first >= CPU_SETSIZE) return -1;
+		p = end;
+		if (*p == '-') //a range
+		{
+			last = strtol(p + 1, &end, 10);
+			if (end == p + 1 || last < first || last >= CPU_SETSIZE) return -1;
+			p = end;
+		}
+		for (long c = first; c <= last; ++c)
+		{
+			CPU_SET(c, set);
+		}
+		if (*p == ',') ++p;
+		else if (*p != '\0' && *p != '\n') return -1;
+		else break;
+	}
+
+	return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+
+//reads the first line of a sysfs file into buf, returns -1 if it can't
+static int read_sysfs(const char* path, char* buf, size_t len)
+{
+	FILE* fp = fopen(path, "r");
+	char* ret = NULL;
+
+	if (fp == NULL) return -1;
+	ret = fgets(buf, len, fp);
+	fclose(fp);
+
+	return ret ? 0 : -1;
+}
+
+
+static int read_sysfs_int(const char* path, int fallback)
+{
+	char buf[64] = {'\0'};
+
+	if (read_sysfs(path, buf, sizeof(buf)) != 0) return fallback;
+
+	return atoi(buf);
+}
+
+
+static int cmp_topo(const void* a, const void* b)
+{
+	const cpu_topo_t* x = a;
+	const cpu_topo_t* y = b;
+
+	if (x->package != y->package) return x->package - y->package;
+	if (x->core != y->core) return x->core - y->core;
+	return x->cpu - y->cpu;
+}
+
+
+//builds auto_cpus: the cpus we are allowed to run on that share a NUMA node
+//with the shell, ordered so SMT siblings come first, then neighbouring cores
+static void build_auto_order(void)
+{
+	cpu_set_t allowed;
+	cpu_set_t node_set;
+	char path[128] = {'\0'};
+	char buf[4096] = {'\0'};
+	int cur = sched_getcpu();
+	cpu_topo_t* topo = NULL;
+	int n = 0;
+
+	auto_count = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+	{
+		perror("pin: sched_getaffinity");
+		return;
+	}
+
+	//find the node the shell is on; without NUMA info every cpu is one node
+	CPU_ZERO(&node_set);
+	for (int node = 0; node < MAX_NUMA_NODES && cur >= 0; ++node)
+	{
+		snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+		if (read_sysfs(path, buf, sizeof(buf)) != 0) continue;
+		if (parse_cpu_list(buf, &node_set) == 0 && CPU_ISSET(cur, &node_set)) break;
+		CPU_ZERO(&node_set);
+	}
+	if (CPU_COUNT(&node_set) > 0)
+	{
+		CPU_AND(&node_set, &node_set, &allowed);
+	}
+	if (CPU_COUNT(&node_set) == 0)
+	{
+		node_set = allowed;
+	}
+
+	topo = calloc(CPU_COUNT(&node_set), sizeof(cpu_topo_t));
+	if (topo == NULL) return;
+	for (int c = 0; c < CPU_SETSIZE; ++c)
+	{
+		if (!CPU_ISSET(c, &node_set)) continue;
+		topo[n].cpu = c;
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", c);
+		topo[n].package = read_sysfs_int(path, 0);
+		snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", c);
+		topo[n].core = read_sysfs_int(path, c);
+		++n;
+	}
+	qsort(topo, n, sizeof(cpu_topo_t), cmp_topo);
+
+	for (int i = 0; i < n; ++i)
+	{
+		auto_cpus[i] = topo[i].cpu;
+	}
+	auto_count = n;
+	free(topo);
+
+	return;
+}
+
+
+//parses a single placement key (cpus=, nice=, ionice=, mem=) into place
+//returns 1 if tok was a placement key, 0 if it wasn't and -1 if the value was bad
+int placement_parse_token(place_t* place, const char* tok)
+{
+	char* end = NULL;
+
+	if (strncmp(tok, PLACE_CPUS, strlen(PLACE_CPUS)) == 0)
+	{
+		cpu_set_t set;
+		const char* val = tok + strlen(PLACE_CPUS);
+
+		if (parse_cpu_list(val, &set) != 0)
+		{
+			fprintf(stderr, "***** bad cpu list: %s *****\n", val);
+			return -1;
+		}
+		free(place->cpu_list);
+		place->cpu_list = strdup(val);
+		return 1;
+	}
+	if (strncmp(tok, PLACE_NICE, strlen(PLACE_NICE)) == 0)
+	{
+		long val = strtol(tok + strlen(PLACE_NICE), &end, 10);
+
+		if (*end != '\0' || end == tok + strlen(PLACE_NICE) || val < -20 || val > 19)
+		{
+			fprintf(stderr, "***** bad nice value: %s *****\n", tok);
+			return -1;
+		}
+		place->has_nice = 1;
+		place->nice_val = (int) val;
+		return 1;
+	}
+	if (strncmp(tok, PLACE_IONICE, strlen(PLACE_IONICE)) == 0)
+	{
+		const char* val = tok + strlen(PLACE_IONICE);
+		const char* colon = strchr(val, ':');
+		size_t len = colon ? (size_t) (colon - val) : strlen(val);
+		int io_class = 0;
+		long level = 4; //the kernel's default best-effort level
+
+		if (strncmp(val, "rt", len) == 0 && len == 2) io_class = IOPRIO_CLASS_RT;
+		else if (strncmp(val, "be", len) == 0 && len == 2) io_class = IOPRIO_CLASS_BE;
+		else if (strncmp(val, "idle", len) == 0 && len == 4) io_class = IOPRIO_CLASS_IDLE;
+		if (colon)
+		{
+			level = strtol(colon + 1, &end, 10);
+			if (*end != '\0' || end == colon + 1) io_class = 0;
+		}
+		if (io_class == 0 || level < 0 || level > 7)
+		{
+			fprintf(stderr, "***** bad ionice value: %s (rt|be|idle[:0-7]) *****\n", val);
+			return -1;
+		}
+		place->io_class = io_class;
+		place->io_level = (io_class == IOPRIO_CLASS_IDLE) ? 0 : (int) level;
+		return 1;
+	}
+	if (strncmp(tok, PLACE_MEM, strlen(PLACE_MEM)) == 0)
+	{
+		long val = strtol(tok + strlen(PLACE_MEM), &end, 10);
+
+		if (*end != '\0' || end == tok + strlen(PLACE_MEM) || val < 0 || val >= MAX_NUMA_NODES - 1)
+		{
+			fprintf(stderr, "***** bad NUMA node: %s *****\n", tok);
+			return -1;
+		}
+		place->has_mem = 1;
+		place->mem_node = (int) val;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+//called in the child before exec. Settings on the stage win over the ones
+//from the pin builtin. Failures are reported but the command still runs.
+void placement_apply(const place_t* stage, int stage_index)
+{
+	const char* cpu_list = stage->cpu_list ? stage->cpu_list : pin_default.cpu_list;
+	const place_t* nice_src = stage->has_nice ? stage : &pin_default;
+	const place_t* io_src = stage->io_class ? stage : &pin_default;
+	const place_t* mem_src = stage->has_mem ? stage : &pin_default;
+	cpu_set_t set;
+	int have_set = 0;
+
+	if (cpu_list && parse_cpu_list(cpu_list, &set) == 0)
+	{
+		have_set = 1;
+	}
+	else if (pin_auto && auto_count > 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(auto_cpus[stage_index % auto_count], &set);
+		have_set = 1;
+	}
+	if (have_set)
+	{
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		{
+			perror("sched_setaffinity");
+		}
+		else if (is_verbose)
+		{
+			if (cpu_list) fprintf(stderr, "verbose: stage %d pinned to cpus %s\n", stage_index, cpu_list);
+			else fprintf(stderr, "verbose: stage %d pinned to cpu %d\n", stage_index, auto_cpus[stage_index % auto_count]);
+		}
+	}
+
+	if (nice_src->has_nice && setpriority(PRIO_PROCESS, 0, nice_src->nice_val) != 0)
+	{
+		perror("setpriority");
+	}
+
+	if (io_src->io_class)
+	{
+		int prio = (io_src->io_class << IOPRIO_CLASS_SHIFT) | io_src->io_level;
+
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) != 0)
+		{
+			perror("ioprio_set");
+		}
+	}
+
+	if (mem_src->has_mem)
+	{
+		unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {0};
+		int bits = 8 * sizeof(unsigned long);
+
+		mask[mem_src->mem_node / bits] |= 1UL << (mem_src->mem_node % bits);
+		if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAX_NUMA_NODES) != 0)
+		{
+			perror("set_mempolicy");
+		}
+	}
+
+	return;
+}
+
+
+void placement_print(FILE* out, const place_t* place, const char* label)
+{
+	static const char* io_names[] = {"none", "rt", "be", "idle"};
+
+	fprintf(out, "%scpus: %s\n", label, place->cpu_list ? place->cpu_list : "<na>");
+	if (place->has_nice) fprintf(out, "%snice: %d\n", label, place->nice_val);
+	else fprintf(out, "%snice: <na>\n", label);
+	fprintf(out, "%sionice: %s:%d\n", label, io_names[place->io_class], place->io_level);
+	if (place->has_mem) fprintf(out, "%smem node: %d\n", label, place->mem_node);
+	else fprintf(out, "%smem node: <na>\n", label);
+
+	return;
+}
+
+
+void free_place(place_t* place)
+{
+	if (place->cpu_list) free(place->cpu_list);
+	memset(place, 0, sizeof(place_t));
+
+	return;
+}
+
+
+//pin               show the current settings
+//pin off           forget all settings
+//pin auto          put adjacent pipeline stages on sibling cores of one node
+//pin key=value ... cpus=, nice=, ionice=, mem= applied to every stage
+void pin_builtin(cmd_t* cmd)
+{
+	param_t* param = cmd->param_list;
+
+	if (param == NULL)
+	{
+		placement_print(stdout, &pin_default, " pin ");
+		if (pin_auto)
+		{
+			printf(" pin auto: %d cpu(s):", auto_count);
+			for (int i = 0; i < auto_count; ++i)
+			{
+				printf(" %d", auto_cpus[i]);
+			}
+			printf("\n");
+		}
+		else
+		{
+			printf(" pin auto: off\n");
+		}
+		return;
+	}
+
+	while (param)
+	{
+		if (strcmp(param->param, "off") == 0)
+		{
+			free_place(&pin_default);
+			pin_auto = 0;
+			auto_count = 0;
+		}
+		else if (strcmp(param->param, "auto") == 0)
+		{
+			build_auto_order();
+			pin_auto = auto_count > 0;
+			if (auto_count == 1)
+			{
+				fprintf(stderr, "pin: only one cpu available, stages will share it\n");
+			}
+		}
+		else if (placement_parse_token(&pin_default, param->param) == 0)
+		{
+			fprintf(stderr, "pin: unknown option %s\n", param->param);
+		}
+		param = param->next;
+	}
+
+	return;
+}
+
+
+//true if placement would change anything for this stage. A builtin that
+//could run inside the shell runs in a forked child instead, so the
+//settings land on it and not on the shell.
+int placement_wanted(const place_t* stage)
+{
+	return stage->cpu_list || stage->has_nice || stage->io_class || stage->has_mem
+		|| pin_default.cpu_list || pin_default.has_nice || pin_default.io_class
+		|| pin_default.has_mem || pin_auto;
+}
+
+
+void pin_cleanup(void)
+{
+	free_place(&pin_default);
+
+	return;
+}
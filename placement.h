@@ -0,0 +1,41 @@
+//placement.h
+//Drake Wheeler
+
+#ifndef _PLACEMENT_H
+# define _PLACEMENT_H
+
+# include <stdio.h>
+
+# define PIN_CMD "pin"
+
+// Per stage annotations look like @cpus=0-3 and the pin builtin takes the
+// same keys without the @ (pin cpus=0-3).
+# define PLACE_PREFIX  '@'
+# define PLACE_CPUS    "cpus="
+# define PLACE_NICE    "nice="
+# define PLACE_IONICE  "ionice="
+# define PLACE_MEM     "mem="
+
+// Scheduling placement applied in the child before exec.
+// A zeroed place_t means "leave everything alone".
+typedef struct place_s {
+    char *cpu_list;   // cpu list such as "0-3,8", NULL if not set
+    int  has_nice;
+    int  nice_val;
+    int  io_class;    // 0 if not set, otherwise IOPRIO_CLASS_RT/BE/IDLE
+    int  io_level;
+    int  has_mem;
+    int  mem_node;    // preferred NUMA node for memory allocations
+} place_t;
+
+struct cmd_s;
+
+int placement_parse_token(place_t *place, const char *tok);
+void placement_apply(const place_t *stage, int stage_index);
+int placement_wanted(const place_t *stage);
+void placement_print(FILE *out, const place_t *place, const char *label);
+void free_place(place_t *place);
+void pin_builtin(struct cmd_s *cmd);
+void pin_cleanup(void);
+
+#endif // _PLACEMENT_H
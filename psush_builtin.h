@@ -0,0 +1,33 @@
+//psush_builtin.h
+//Drake Wheeler
+
+// What a loadable builtin is written against. This header stands alone so a
+// plugin can be built without the rest of the shell:
+//
+//     gcc -shared -fPIC -o libhello.so hello.c
+//     enable -f ./libhello.so hello
+//
+// enable -f looks up the symbol NAME_builtin, a psush_builtin_t, in the
+// library. run() gets the arguments as argv (argv[0] is the name) and must
+// read from in_fd and write to out_fd rather than stdin and stdout, because
+// on its own it runs inside the shell with < and > opened for it. In a
+// pipeline it runs in the stage's process with in_fd and out_fd already the
+// pipe ends. What it returns is the exit status. Running in the shell means
+// it must free what it allocates and not call exit(). Ctrl-C in the shell
+// makes a blocked read() or write() fail with EINTR, which should end run().
+
+#ifndef _PSUSH_BUILTIN_H
+# define _PSUSH_BUILTIN_H
+
+# define PSUSH_BUILTIN_ABI 1 //bumped whenever psush_builtin_t changes
+
+typedef struct psush_builtin_s {
+    int        abi;    //PSUSH_BUILTIN_ABI the plugin was built with
+    const char *name;
+    int        (*run)(int argc, char **argv, int in_fd, int out_fd);
+    int        (*load)(void);   //optional, nonzero refuses the enable
+    void       (*unload)(void); //optional, called by enable -d and at exit
+    const char *usage;          //optional one line help
+} psush_builtin_t;
+
+#endif // _PSUSH_BUILTIN_H
@@ -0,0 +1,343 @@
+//watch.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for pipe2()
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#include "cmd_parse.h"
+#include "watch.h"
+
+//a file is watched through its directory so editors that write a new file
+//and rename it over the old one are still seen
+#define WATCH_FILE_EVENTS (IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE)
+#define WATCH_DIR_EVENTS  (WATCH_FILE_EVENTS | IN_MOVED_FROM)
+#define WATCH_EVENT_BUF 4096
+
+extern unsigned short is_verbose;
+extern volatile sig_atomic_t got_sigint;
+
+// One watched path. name is the file inside the watched directory, or
+// NULL when the path itself is a directory and anything in it counts.
+typedef struct watch_ent_s {
+	int  wd;
+	char *name;
+} watch_ent_t;
+
+typedef struct watch_s {
+	char        **paths;
+	int         path_count;
+	watch_ent_t *ents;
+	int         ent_count;
+	int         debounce_ms;
+	int         cancel;       //kill a run that is going when a change lands
+	int         ifd;          //inotify descriptor
+	pid_t       runner;       //process running the pipeline, 0 if idle
+	int         done_fd;      //hangs up when the runner exits
+} watch_t;
+
+
+static long long watch_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void watch_free(watch_t* w)
+{
+	for (int i = 0; i < w->path_count; ++i)
+	{
+		free(w->paths[i]);
+	}
+	for (int i = 0; i < w->ent_count; ++i)
+	{
+		free(w->ents[i].name);
+	}
+	free(w->paths);
+	free(w->ents);
+	if (w->ifd >= 0) close(w->ifd);
+	if (w->done_fd >= 0) close(w->done_fd);
+
+	return;
+}
+
+
+static void watch_add_path(watch_t* w, const char* path)
+{
+	w->paths = realloc(w->paths, (w->path_count + 1) * sizeof(char*));
+	w->paths[w->path_count++] = strdup(path);
+
+	return;
+}
+
+
+//takes "watch" and its own options off the front of the first command so
+//what is left is the pipeline to run. Returns -1 if there's no command.
+static int watch_strip(watch_t* w, cmd_t* cmd)
+{
+	while (cmd->param_list && cmd->param_list->param[0] == '-')
+	{
+		char* opt = shift_param(cmd);
+		char* val = NULL;
+
+		if (strcmp(opt, "-k") == 0)
+		{
+			w->cancel = 1;
+		}
+		else if ((strcmp(opt, "-p") == 0 || strcmp(opt, "-d") == 0) && cmd->param_list)
+		{
+			val = shift_param(cmd);
+			if (opt[1] == 'p') watch_add_path(w, val);
+			else w->debounce_ms = atoi(val);
+		}
+		else
+		{
+			fprintf(stderr, "watch: unknown option %s\n", opt);
+			free(opt);
+			return -1;
+		}
+		free(opt);
+		free(val);
+	}
+
+	if (cmd->param_list == NULL)
+	{
+		fprintf(stderr, "usage: watch [-p path]... [-d ms] [-k] command ...\n");
+		return -1;
+	}
+
+	//the first parameter becomes the command
+	free(cmd->cmd);
+	cmd->cmd = shift_param(cmd);
+
+	return 0;
+}
+
+
+static int watch_register(watch_t* w)
+{
+	w->ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (w->ifd < 0)
+	{
+		perror("watch: inotify_init1");
+		return -1;
+	}
+	w->ents = calloc(w->path_count, sizeof(watch_ent_t));
+
+	for (int i = 0; i < w->path_count; ++i)
+	{
+		struct stat st;
+		char* dir_copy = strdup(w->paths[i]);
+		char* base_copy = strdup(w->paths[i]);
+		watch_ent_t* ent = &w->ents[w->ent_count];
+
+		if (stat(w->paths[i], &st) == 0 && S_ISDIR(st.st_mode))
+		{
+			ent->wd = inotify_add_watch(w->ifd, w->paths[i], WATCH_DIR_EVENTS);
+			ent->name = NULL;
+		}
+		else
+		{
+			ent->wd = inotify_add_watch(w->ifd, dirname(dir_copy), WATCH_FILE_EVENTS);
+			ent->name = strdup(basename(base_copy));
+		}
+		free(dir_copy);
+		free(base_copy);
+
+		if (ent->wd < 0)
+		{
+			fprintf(stderr, "watch: %s: %s\n", w->paths[i], strerror(errno));
+			free(ent->name);
+			continue;
+		}
+		++w->ent_count;
+	}
+
+	return w->ent_count > 0 ? 0 : -1;
+}
+
+
+//drains the inotify queue, returns 1 if anything we care about changed
+static int watch_drain(watch_t* w)
+{
+	char buf[WATCH_EVENT_BUF] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t n = 0;
+	int changed = 0;
+
+	while ((n = read(w->ifd, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + n; )
+		{
+			const struct inotify_event* ev = (const struct inotify_event*) p;
+
+			for (int i = 0; i < w->ent_count; ++i)
+			{
+				if (w->ents[i].wd != ev->wd) continue;
+				if (w->ents[i].name == NULL || (ev->len && strcmp(w->ents[i].name, ev->name) == 0))
+				{
+					changed = 1;
+				}
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+
+	return changed;
+}
+
+
+//starts the pipeline in its own process group, so a cancel can take out
+//every stage at once
+static void watch_start(watch_t* w, cmd_list_t* cmds)
+{
+	int done[2] = {-1, -1};
+
+	if (pipe2(done, O_CLOEXEC) == -1)
+	{
+		perror("watch: pipe");
+		return;
+	}
+	fflush(stdout);
+	fflush(stderr);
+
+	w->runner = fork();
+	if (w->runner == -1)
+	{
+		perror("watch: fork");
+		w->runner = 0;
+		close(done[0]);
+		close(done[1]);
+		return;
+	}
+	if (w->runner == 0)
+	{
+		setpgid(0, 0);
+		got_sigint = 0; //a Ctrl-C seen by the shell is not this run's
+		close(done[0]);
+		exec_commands(cmds);
+		watch_free(w);
+		child_cleanup(cmds);
+		exit(EXIT_SUCCESS);
+	}
+	setpgid(w->runner, w->runner);
+	close(done[1]);
+	w->done_fd = done[0];
+	if (is_verbose) fprintf(stderr, "verbose: watch: run started, pid %d\n", w->runner);
+
+	return;
+}
+
+
+static void watch_reap(watch_t* w)
+{
+	waitpid(w->runner, NULL, 0);
+	close(w->done_fd);
+	w->done_fd = -1;
+	w->runner = 0;
+
+	return;
+}
+
+
+//watch [-p path]... [-d ms] [-k] command ...
+//runs the pipeline, then again each time one of the paths changes. With no
+//-p, the < input files of the pipeline are watched. Bursts of changes are
+//folded into one rerun once things are quiet for -d milliseconds, and -k
+//kills a run that is still going when new data lands. Ctrl-C ends it.
+void watch_builtin(cmd_list_t* cmds)
+{
+	watch_t w = {NULL, 0, NULL, 0, WATCH_DEBOUNCE_MS, 0, -1, 0, -1};
+	int pending = 0;
+	long long last_change = 0;
+
+	if (watch_strip(&w, cmds->head) != 0)
+	{
+		watch_free(&w);
+		return;
+	}
+	if (w.path_count == 0)
+	{
+		for (cmd_t* cmd = cmds->head; cmd; cmd = cmd->next)
+		{
+			if (cmd->input_file_name) watch_add_path(&w, cmd->input_file_name);
+		}
+	}
+	if (w.path_count == 0)
+	{
+		fprintf(stderr, "watch: nothing to watch, give -p path or a < file\n");
+		watch_free(&w);
+		return;
+	}
+	if (watch_register(&w) != 0)
+	{
+		watch_free(&w);
+		return;
+	}
+
+	watch_start(&w, cmds);
+	for ( ; ; )
+	{
+		struct pollfd pfd[2] = {{w.ifd, POLLIN, 0}, {w.done_fd, POLLIN, 0}};
+		int timeout = -1;
+		int ret = 0;
+
+		if (pending && !w.runner)
+		{
+			timeout = (int) (last_change + w.debounce_ms - watch_now_ms());
+			if (timeout < 0) timeout = 0;
+		}
+
+		//an idle watch sleeps here and costs nothing
+		ret = poll(pfd, w.runner ? 2 : 1, timeout);
+		if (ret < 0)
+		{
+			if (errno != EINTR) perror("watch: poll");
+			break; //Ctrl-C
+		}
+
+		if (pfd[0].revents & POLLIN && watch_drain(&w))
+		{
+			pending = 1;
+			last_change = watch_now_ms();
+			if (w.runner && w.cancel)
+			{
+				if (is_verbose) fprintf(stderr, "verbose: watch: change during run, cancelling\n");
+				kill(-w.runner, SIGTERM);
+			}
+		}
+		if (w.runner && pfd[1].revents)
+		{
+			watch_reap(&w);
+		}
+		if (pending && !w.runner && watch_now_ms() - last_change >= w.debounce_ms)
+		{
+			pending = 0;
+			watch_start(&w, cmds);
+		}
+	}
+
+	if (w.runner)
+	{
+		kill(-w.runner, SIGINT);
+		watch_reap(&w);
+	}
+	watch_free(&w);
+
+	return;
+}
@@ -0,0 +1,15 @@
+//watch.h
+//Drake Wheeler
+
+#ifndef _WATCH_H
+# define _WATCH_H
+
+# define WATCH_CMD "watch"
+
+# define WATCH_DEBOUNCE_MS 100 //quiet time after the last change before a rerun
+
+struct cmd_list_s;
+
+void watch_builtin(struct cmd_list_s *cmds);
+
+#endif // _WATCH_H
@@ -0,0 +1,496 @@
+//wc.c
+//Drake Wheeler
+
+#define _GNU_SOURCE //for newlocale() and uselocale()
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <locale.h>
+#include <sys/stat.h>
+
+//the lines kernel uses _mm256_extract_epi64(), which is x86_64 only
+#if defined(__x86_64__)
+# include <immintrin.h>
+# define WC_HAVE_SIMD 1
+#endif // __x86_64__
+
+#include "cmd_parse.h"
+#include "wc.h"
+
+#define WC_BUF_SIZE (1 << 20) //read() size for pipes and terminals
+#define WC_ALIGN 64
+#define WC_WIDTH_PIPE 7 //column width coreutils uses when it can't stat the input
+
+extern volatile sig_atomic_t got_sigint;
+
+#define WC_LINES 0x1
+#define WC_WORDS 0x2
+#define WC_BYTES 0x4
+
+// Running totals for one input. in_space carries "no word is open" across
+// buffers so a word split by a read() counts once.
+typedef struct wc_counts_s {
+	unsigned long long lines;
+	unsigned long long words;
+	unsigned long long bytes;
+	unsigned int in_space;
+	int regular; //input was a regular file
+} wc_counts_t;
+
+typedef void (*wc_kernel_t)(const unsigned char*, size_t, wc_counts_t*);
+
+static wc_kernel_t wc_kernel = NULL; //picked on first use by wc_pick_kernel()
+static wc_kernel_t wc_line_kernel = NULL; //same, when only lines are wanted
+
+
+//Words follow coreutils in the C locale: white space (as isspace() sees
+//it) ends a word, a printable byte starts or continues one, and anything
+//else (control bytes, 0x7f and up) does neither.
+static inline int wc_is_space(unsigned char c)
+{
+	return c == ' ' || (unsigned char) (c - '\t') <= ('\r' - '\t');
+}
+
+
+static inline int wc_is_print(unsigned char c)
+{
+	return c > ' ' && c < 0x7f;
+}
+
+
+//counts lines and words in a span without touching the byte count, and
+//returns the in_space state at its end
+static unsigned int count_span(const unsigned char* buf, size_t len, unsigned int prev, wc_counts_t* c)
+{
+	for (size_t i = 0; i < len; ++i)
+	{
+		c->lines += (buf[i] == '\n');
+		if (wc_is_space(buf[i]))
+		{
+			prev = 1;
+		}
+		else if (wc_is_print(buf[i]))
+		{
+			c->words += prev;
+			prev = 0;
+		}
+	}
+
+	return prev;
+}
+
+
+static void count_scalar(const unsigned char* buf, size_t len, wc_counts_t* c)
+{
+	c->in_space = count_span(buf, len, c->in_space, c);
+	c->bytes += len;
+
+	return;
+}
+
+
+//newlines only, for wc -l. glibc's memchr() is already vectorized.
+static void count_lines_scalar(const unsigned char* buf, size_t len, wc_counts_t* c)
+{
+	const unsigned char* p = buf;
+	const unsigned char* end = buf + len;
+
+	while (p < end && (p = memchr(p, '\n', end - p)) != NULL)
+	{
+		++c->lines;
+		++p;
+	}
+	c->bytes += len;
+
+	return;
+}
+
+
+#ifdef WC_HAVE_SIMD
+//each block gives a bit mask of white space bytes; a word starts where a
+//byte is not space and the one before it was, so words += popcount of
+//~ws & (ws << 1 | carry). Newlines are a popcount of a compare mask. That
+//only holds when every byte is space or printable, so a block with any
+//other byte in it (rare outside binary data) is counted by count_span().
+__attribute__((target("sse2")))
+static void count_sse2(const unsigned char* buf, size_t len, wc_counts_t* c)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i sp = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i ctl = _mm_set1_epi8('\r' - '\t');
+	const __m128i del = _mm_set1_epi8(0x7f);
+	unsigned int prev = c->in_space;
+	size_t i = 0;
+
+	for ( ; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+		__m128i x = _mm_sub_epi8(v, tab);
+		__m128i ws = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x), _mm_cmpeq_epi8(v, sp));
+		__m128i pr = _mm_and_si128(_mm_cmpgt_epi8(v, sp), _mm_cmpgt_epi8(del, v)); //signed, so 0x80 and up fail
+		unsigned int wsm = (unsigned int) _mm_movemask_epi8(ws);
+		unsigned int nlm = 0;
+		unsigned int starts = 0;
+
+		if ((wsm | (unsigned int) _mm_movemask_epi8(pr)) != 0xffff)
+		{
+			prev = count_span(buf + i, 16, prev, c);
+			continue;
+		}
+		nlm = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+		starts = ~wsm & ((wsm << 1) | prev) & 0xffff;
+
+		c->lines += __builtin_popcount(nlm);
+		c->words += __builtin_popcount(starts);
+		prev = wsm >> 15;
+	}
+	c->in_space = prev;
+	c->bytes += i;
+	count_scalar(buf + i, len - i, c); //the tail that doesn't fill a block
+
+	return;
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static void count_avx2(const unsigned char* buf, size_t len, wc_counts_t* c)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i sp = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i ctl = _mm256_set1_epi8('\r' - '\t');
+	const __m256i del = _mm256_set1_epi8(0x7f);
+	unsigned int prev = c->in_space;
+	size_t i = 0;
+
+	for ( ; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+		__m256i x = _mm256_sub_epi8(v, tab);
+		__m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x, ctl), x), _mm256_cmpeq_epi8(v, sp));
+		__m256i pr = _mm256_and_si256(_mm256_cmpgt_epi8(v, sp), _mm256_cmpgt_epi8(del, v));
+		unsigned int wsm = (unsigned int) _mm256_movemask_epi8(ws);
+		unsigned int nlm = 0;
+		unsigned int starts = 0;
+
+		if ((wsm | (unsigned int) _mm256_movemask_epi8(pr)) != 0xffffffffu)
+		{
+			prev = count_span(buf + i, 32, prev, c);
+			continue;
+		}
+		nlm = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+		starts = ~wsm & ((wsm << 1) | prev);
+
+		c->lines += __builtin_popcount(nlm);
+		c->words += __builtin_popcount(starts);
+		prev = wsm >> 31;
+	}
+	c->in_space = prev;
+	c->bytes += i;
+	count_sse2(buf + i, len - i, c);
+
+	return;
+}
+
+
+//newline compares are summed per byte lane (a match is -1, so subtract)
+//and folded into 64 bit totals with sad before a lane can overflow
+__attribute__((target("avx2")))
+static void count_lines_avx2(const unsigned char* buf, size_t len, wc_counts_t* c)
+{
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i total = _mm256_setzero_si256();
+	size_t i = 0;
+
+	while (i + 32 <= len)
+	{
+		__m256i lanes = _mm256_setzero_si256();
+
+		for (int k = 0; k < 255 && i + 32 <= len; ++k, i += 32)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+
+			lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(v, nl));
+		}
+		total = _mm256_add_epi64(total, _mm256_sad_epu8(lanes, zero));
+	}
+	c->lines += _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1)
+		+ _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+	c->bytes += i;
+	count_lines_scalar(buf + i, len - i, c);
+
+	return;
+}
+#endif // WC_HAVE_SIMD
+
+
+//picks the widest kernel this cpu can run, once
+static void wc_pick_kernel(void)
+{
+	if (wc_kernel) return;
+
+	wc_kernel = count_scalar;
+	wc_line_kernel = count_lines_scalar;
+#ifdef WC_HAVE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) wc_line_kernel = count_lines_avx2;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) wc_kernel = count_avx2;
+	else if (__builtin_cpu_supports("sse2")) wc_kernel = count_sse2;
+#endif // WC_HAVE_SIMD
+
+	return;
+}
+
+
+//counts everything readable from fd. Plain read() into one aligned buffer
+//beat mmap() here, the page faults cost more than the copy. When only bytes
+//are wanted from a regular file the size comes straight from fstat().
+static int wc_count_fd(int fd, int what, wc_counts_t* c)
+{
+	struct stat st;
+	unsigned char* buf = NULL;
+	ssize_t n = 0;
+	wc_kernel_t kernel = (what == WC_LINES) ? wc_line_kernel : wc_kernel;
+
+	memset(c, 0, sizeof(wc_counts_t));
+	c->in_space = 1;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		c->regular = 1;
+		//like coreutils, a size of 0 or a whole number of pages may be made
+		//up (/proc, /sys), so those get read
+		if (what == WC_BYTES && lseek(fd, 0, SEEK_CUR) == 0
+			&& st.st_size > 0 && st.st_size % sysconf(_SC_PAGESIZE) != 0)
+		{
+			c->bytes = st.st_size;
+			return 0;
+		}
+	}
+
+	if (posix_memalign((void**) &buf, WC_ALIGN, WC_BUF_SIZE) != 0)
+	{
+		fprintf(stderr, "wc: out of memory\n");
+		return -1;
+	}
+	while ((n = read(fd, buf, WC_BUF_SIZE)) != 0)
+	{
+		if (got_sigint) //Ctrl-C while running in the shell
+		{
+			free(buf);
+			errno = EINTR;
+			return -1;
+		}
+		if (n < 0)
+		{
+			if (errno == EINTR) continue;
+			free(buf);
+			return -1;
+		}
+		kernel(buf, n, c);
+	}
+	free(buf);
+
+	return 0;
+}
+
+
+static int wc_digits(unsigned long long val)
+{
+	int d = 1;
+
+	while (val >= 10)
+	{
+		val /= 10;
+		++d;
+	}
+
+	return d;
+}
+
+
+static void wc_print(int out_fd, int what, int width, const wc_counts_t* c, const char* name)
+{
+	char line[128] = {'\0'};
+	int len = 0;
+	const char* sep = "";
+
+	if (what & WC_LINES)
+	{
+		len += snprintf(line + len, sizeof(line) - len, "%*llu", width, c->lines);
+		sep = " ";
+	}
+	if (what & WC_WORDS)
+	{
+		len += snprintf(line + len, sizeof(line) - len, "%s%*llu", sep, width, c->words);
+		sep = " ";
+	}
+	if (what & WC_BYTES)
+	{
+		len += snprintf(line + len, sizeof(line) - len, "%s%*llu", sep, width, c->bytes);
+	}
+	if (name) dprintf(out_fd, "%s %s\n", line, name);
+	else dprintf(out_fd, "%s\n", line);
+
+	return;
+}
+
+
+//parses -l -w -c (or any mix like -lw) into a mask, 0 if an option is one
+//we don't do, in which case the real wc gets exec'd instead
+static int wc_options(cmd_t* cmd)
+{
+	int what = 0;
+
+	for (param_t* param = cmd->param_list; param; param = param->next)
+	{
+		const char* p = param->param;
+
+		if (p[0] != '-' || p[1] == '\0') continue; //a file name, or - for stdin
+		while (*++p)
+		{
+			if (*p == 'l') what |= WC_LINES;
+			else if (*p == 'w') what |= WC_WORDS;
+			else if (*p == 'c') what |= WC_BYTES;
+			else return 0;
+		}
+	}
+
+	return what ? what : WC_LINES | WC_WORDS | WC_BYTES;
+}
+
+
+//true when the user's LC_CTYPE is multibyte, UTF-8 and the like. The shell
+//never calls setlocale(), so this asks what the environment would give the
+//system wc. Looked up once.
+static int wc_multibyte_locale(void)
+{
+	static int multibyte = -1;
+
+	if (multibyte < 0)
+	{
+		locale_t loc = newlocale(LC_CTYPE_MASK, "", (locale_t) 0);
+
+		multibyte = 0;
+		if (loc != (locale_t) 0)
+		{
+			locale_t old = uselocale(loc);
+
+			multibyte = MB_CUR_MAX > 1;
+			uselocale(old);
+			freelocale(loc);
+		}
+	}
+
+	return multibyte;
+}
+
+
+//returns non zero if wc_run() understands every option on this wc. Words
+//are counted the C locale way, so in a multibyte locale, where white space
+//like U+3000 splits words too, -w goes to the system wc.
+int wc_supported(cmd_t* cmd)
+{
+	int what = wc_options(cmd);
+
+	if ((what & WC_WORDS) && wc_multibyte_locale()) return 0;
+
+	return what != 0;
+}
+
+
+//the in process wc. Reads in_fd when no files are named and writes the
+//counts to out_fd. Returns the exit status, like the real wc would.
+int wc_run(cmd_t* cmd, int in_fd, int out_fd)
+{
+	int what = wc_options(cmd);
+	int fields = !!(what & WC_LINES) + !!(what & WC_WORDS) + !!(what & WC_BYTES);
+	int nfiles = 0;
+	int ret = 0;
+	int width = 1;
+	int i = 0;
+	wc_counts_t total = {0, 0, 0, 0, 1};
+	wc_counts_t* counts = NULL;
+	const char** names = NULL;
+
+	wc_pick_kernel();
+
+	for (param_t* param = cmd->param_list; param; param = param->next)
+	{
+		if (param->param[0] != '-' || param->param[1] == '\0') ++nfiles;
+	}
+	counts = calloc(nfiles ? nfiles : 1, sizeof(wc_counts_t));
+	names = calloc(nfiles ? nfiles : 1, sizeof(char*));
+
+	if (nfiles == 0)
+	{
+		if (wc_count_fd(in_fd, what, &counts[0]) != 0)
+		{
+			if (!got_sigint) perror("wc");
+			ret = 1;
+		}
+		total = counts[0];
+		i = 1;
+	}
+	for (param_t* param = cmd->param_list; param; param = param->next)
+	{
+		const char* name = param->param;
+		int fd = -1;
+
+		if (name[0] == '-' && name[1] != '\0') continue;
+		if (got_sigint) break;
+		names[i] = name;
+		fd = strcmp(name, "-") == 0 ? in_fd : open(name, O_RDONLY);
+		if (fd < 0 || wc_count_fd(fd, what, &counts[i]) != 0)
+		{
+			fprintf(stderr, "wc: %s: %s\n", name, strerror(errno));
+			names[i] = NULL;
+			ret = 1;
+		}
+		else
+		{
+			total.lines += counts[i].lines;
+			total.words += counts[i].words;
+			total.bytes += counts[i].bytes;
+			total.regular &= counts[i].regular;
+		}
+		if (fd >= 0 && fd != in_fd) close(fd);
+		++i;
+	}
+
+	if (got_sigint) //interrupted, no counts are better than wrong ones
+	{
+		free(counts);
+		free(names);
+		return 128 + SIGINT;
+	}
+
+	//same column rules as coreutils: one number for one input is not padded,
+	//otherwise wide enough for the biggest total, at least 7 for a pipe
+	if (fields > 1 || nfiles > 1)
+	{
+		width = wc_digits(total.lines);
+		if (wc_digits(total.words) > width) width = wc_digits(total.words);
+		if (wc_digits(total.bytes) > width) width = wc_digits(total.bytes);
+		if (!total.regular && width < WC_WIDTH_PIPE) width = WC_WIDTH_PIPE;
+	}
+
+	fflush(stdout); //keep our output behind anything a builtin already printed
+	for (int j = 0; j < i; ++j)
+	{
+		if (nfiles == 0 || names[j]) wc_print(out_fd, what, width, &counts[j], names[j]);
+	}
+	if (nfiles > 1) wc_print(out_fd, what, width, &total, "total");
+
+	free(counts);
+	free(names);
+
+	return ret;
+}
@@ -0,0 +1,14 @@
+//wc.h
+//Drake Wheeler
+
+#ifndef _WC_H
+# define _WC_H
+
+# define WC_CMD "wc"
+
+struct cmd_s;
+
+int wc_supported(struct cmd_s *cmd);
+int wc_run(struct cmd_s *cmd, int in_fd, int out_fd);
+
+#endif // _WC_H